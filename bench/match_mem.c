@@ -0,0 +1,131 @@
+// Orcamento de memoria por partida do servidor de Batalha Naval.
+//
+// Cria N partidas paradas no meio do jogo (dois jogadores com nome, frota completa, alguns
+// tiros dados e a vez definida) com o mesmo codigo de partidas do servidor (server/match.c,
+// nomes internados pelo lobby) e mede quanto o RSS do processo cresceu. Depois destroi todas
+// e cria de novo, para conferir que os registros sao reaproveitados sem crescer o RSS.
+// Falha (codigo de saida 1) se as partidas passarem do orcamento.
+//
+// Uso: bench/match_mem [--matches N] [--budget-mb MB]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../server/match.h"
+#include "../server/lobby.h"
+
+#define MATCHES_DEFAULT 1000000
+#define BUDGET_MB_DEFAULT 400
+
+// Frota usada em todas as partidas: {tipo, x, y, vertical}
+static const int fleet[MAX_SHIPS][4] = { {0, 0, 0, 0}, {1, 2, 0, 0}, {1, 4, 0, 0}, {2, 6, 0, 0} };
+
+static long rss_kb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) sscanf(line, "VmRSS: %ld", &kb);
+    fclose(f);
+    return kb;
+}
+
+static void place_fleet(Player *player) {
+    for (int k = 0; k < MAX_SHIPS; k++) {
+        ShipDesc *ship = &player->fleet[k];
+        ship->origin = (uint8_t)(fleet[k][1] * BOARD_SIZE + fleet[k][2]);
+        ship->type = (uint8_t)fleet[k][0];
+        ship->vertical = (uint8_t)fleet[k][3];
+        player->ships |= ship_cells(*ship);
+    }
+    player->num_ships_placed = MAX_SHIPS;
+    player->ready = 1;
+}
+
+// Partida parada na vez do primeiro jogador, depois de um acerto e um tiro na agua
+static Match *idle_match(long i) {
+    char name[NAME_MAX_LEN];
+    Match *match = match_create("");
+    if (!match) return NULL;
+    for (int p = 0; p < PLAYERS_PER_MATCH; p++) {
+        snprintf(name, sizeof(name), "%c%07ld", p == 0 ? 'a' : 'b', i);
+        if (player_set_name(&match->players[p], name) < 0) {
+            match_destroy(match);
+            return NULL;
+        }
+        place_fleet(&match->players[p]);
+    }
+    match->players[1].hits |= cell_bit(0, 0);
+    match->players[1].fleet[0].hits = 1;
+    match->players[0].ships_sunk = 1;
+    match->players[0].misses |= cell_bit(7, 7);
+    match->num_players = PLAYERS_PER_MATCH;
+    match->refs = PLAYERS_PER_MATCH;
+    match->game_started = 1;
+    match->current_player_turn = 0;
+    match->turn_count = 2;
+    return match;
+}
+
+// Cria as partidas em matches; retorna o crescimento do RSS em KB ou -1 sem memoria
+static long create_all(Match **matches, long n) {
+    long before = rss_kb();
+    for (long i = 0; i < n; i++) {
+        matches[i] = idle_match(i);
+        if (!matches[i]) {
+            fprintf(stderr, "Sem memoria na partida %ld.\n", i);
+            return -1;
+        }
+    }
+    return rss_kb() - before;
+}
+
+static void destroy_all(Match **matches, long n) {
+    for (long i = 0; i < n; i++) match_release(matches[i]);
+    for (long i = 0; i < n; i++) match_release(matches[i]);
+}
+
+int main(int argc, char *argv[]) {
+    long n = MATCHES_DEFAULT;
+    long budget_mb = BUDGET_MB_DEFAULT;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--matches") == 0 && i + 1 < argc) {
+            n = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--budget-mb") == 0 && i + 1 < argc) {
+            budget_mb = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "Uso: %s [--matches N] [--budget-mb MB]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n < 1) n = 1;
+
+    Match **matches = malloc((size_t)n * sizeof(Match *));
+    if (!matches || lobby_init() < 0) return 1;
+    printf("Registro da partida: %zu bytes (%zu de estado quente, jogador %zu bytes), alinhado a %d\n",
+           sizeof(Match), offsetof(Match, cold), sizeof(Player), CACHE_LINE);
+
+    long grown_kb = create_all(matches, n);
+    if (grown_kb < 0) return 1;
+    double per_match = grown_kb * 1024.0 / (double)n;
+    printf("%ld partidas paradas: RSS +%.1f MB (%.0f bytes por partida, nomes incluidos)\n",
+           n, grown_kb / 1024.0, per_match);
+
+    destroy_all(matches, n);
+    long regrown_kb = create_all(matches, n);
+    if (regrown_kb < 0) return 1;
+    printf("Destruidas e recriadas: RSS +%.1f MB (registros reaproveitados)\n", regrown_kb / 1024.0);
+    destroy_all(matches, n);
+    free(matches);
+
+    // Orcamento proporcional ao numero de partidas (budget_mb vale para um milhao)
+    double allowed_kb = budget_mb * 1024.0 * (double)n / 1e6;
+    if (grown_kb > allowed_kb) {
+        printf("FALHA: %.1f MB acima do orcamento de %.1f MB.\n", grown_kb / 1024.0, allowed_kb / 1024.0);
+        return 1;
+    }
+    printf("OK: dentro do orcamento de %.1f MB.\n", allowed_kb / 1024.0);
+    return 0;
+}
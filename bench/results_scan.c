@@ -0,0 +1,189 @@
+// Leitor do arquivo de resultados do servidor de Batalha Naval (--results).
+//
+// Mapeia o arquivo inteiro e percorre os grupos lendo so as colunas usadas nas contas:
+// total de partidas, vitorias por posicao, duracao e turnos medios, aproveitamento dos tiros,
+// primeiro navio afundado por tipo e partidas no modo salvo. Com --player, conta tambem as
+// vitorias e derrotas de um jogador (unico caso em que a coluna de nomes e lida). No fim
+// mostra o tempo da varredura e quantas partidas por segundo foram lidas.
+//
+// Uso: bench/results_scan <arquivo> [--player nome] [--repeat N]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../server/results.h"
+
+#define SHIP_TYPES 3 // Mesma ordem de ship_types em server/match.c
+static const char *ship_names[SHIP_TYPES] = { "SUBMARINO", "FRAGATA", "DESTROYER" };
+
+typedef struct {
+    unsigned long long games;
+    unsigned long long wins[2];
+    unsigned long long salvo;
+    unsigned long long duration_sum;
+    uint32_t duration_max;
+    unsigned long long turns_sum;
+    unsigned long long shots;
+    unsigned long long hits;
+    unsigned long long first_sunk[SHIP_TYPES];
+    unsigned long long player_wins;
+    unsigned long long player_losses;
+} Totals;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Soma um grupo; as colunas sao vetores contiguos, entao cada laco le so a sua
+static void scan_group(const unsigned char *group, uint32_t rows, const char *player, Totals *t) {
+    const uint32_t *duration = (const uint32_t *)(group + results_column_offset(RESULTS_COL_DURATION, rows));
+    const uint16_t *turns = (const uint16_t *)(group + results_column_offset(RESULTS_COL_TURNS, rows));
+    const uint8_t *winner = group + results_column_offset(RESULTS_COL_WINNER, rows);
+    const uint8_t *flags = group + results_column_offset(RESULTS_COL_FLAGS, rows);
+    const uint16_t *shots = (const uint16_t *)(group + results_column_offset(RESULTS_COL_SHOTS, rows));
+    const uint16_t *hits = (const uint16_t *)(group + results_column_offset(RESULTS_COL_HITS, rows));
+    const uint8_t *sunk = group + results_column_offset(RESULTS_COL_SUNK_ORDER, rows);
+
+    unsigned long long duration_sum = 0, turns_sum = 0, wins1 = 0, salvo = 0, shot_sum = 0, hit_sum = 0;
+    uint32_t duration_max = t->duration_max;
+    for (uint32_t r = 0; r < rows; r++) {
+        duration_sum += duration[r];
+        if (duration[r] > duration_max) duration_max = duration[r];
+        turns_sum += turns[r];
+        wins1 += winner[r];
+        salvo += flags[r] & RESULTS_FLAG_SALVO;
+    }
+    for (uint32_t r = 0; r < 2 * rows; r++) {
+        shot_sum += shots[r];
+        hit_sum += hits[r];
+    }
+    for (uint32_t r = 0; r < rows; r++) {
+        uint8_t first = sunk[(size_t)r * RESULTS_SUNK_MAX];
+        if (first != RESULTS_SUNK_NONE && (first & 7) < SHIP_TYPES) t->first_sunk[first & 7]++;
+    }
+
+    t->games += rows;
+    t->wins[1] += wins1;
+    t->wins[0] += rows - wins1;
+    t->salvo += salvo;
+    t->duration_sum += duration_sum;
+    t->duration_max = duration_max;
+    t->turns_sum += turns_sum;
+    t->shots += shot_sum;
+    t->hits += hit_sum;
+
+    if (player) {
+        const char (*names)[2][RESULTS_NAME_LEN] =
+            (const char (*)[2][RESULTS_NAME_LEN])(group + results_column_offset(RESULTS_COL_NAMES, rows));
+        for (uint32_t r = 0; r < rows; r++) {
+            for (int p = 0; p < 2; p++) {
+                if (strncmp(names[r][p], player, RESULTS_NAME_LEN) != 0) continue;
+                if (winner[r] == p) t->player_wins++;
+                else t->player_losses++;
+            }
+        }
+    }
+}
+
+// Percorre o arquivo todo; retorna onde parou (menor que size se um grupo estiver cortado)
+static size_t scan_file(const unsigned char *data, size_t size, const char *player, Totals *t) {
+    size_t pos = sizeof(ResultsFileHeader);
+    while (pos + sizeof(ResultsGroupHeader) <= size) {
+        ResultsGroupHeader header;
+        memcpy(&header, data + pos, sizeof(header));
+        if (header.magic != RESULTS_GROUP_MAGIC || header.bytes != results_group_bytes(header.rows) ||
+            header.bytes > size - pos) {
+            break;
+        }
+        scan_group(data + pos, header.rows, player, t);
+        pos += header.bytes;
+    }
+    return pos;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL;
+    const char *player = NULL;
+    int repeat = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--player") == 0 && i + 1 < argc) {
+            player = argv[++i];
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (!path && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "Uso: %s <arquivo> [--player nome] [--repeat N]\n", argv[0]);
+        return 1;
+    }
+    if (repeat < 1) repeat = 1;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(ResultsFileHeader)) {
+        fprintf(stderr, "%s: arquivo vazio ou cortado.\n", path);
+        return 1;
+    }
+    const unsigned char *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    ResultsFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != RESULTS_MAGIC || header.version != RESULTS_VERSION || header.row_bytes != results_row_bytes()) {
+        fprintf(stderr, "%s: nao e um arquivo de resultados desta versao.\n", path);
+        return 1;
+    }
+
+    // Com --repeat a varredura se repete (arquivo ja na memoria) para medir a vazao
+    Totals t;
+    size_t end = 0;
+    double start = now_sec();
+    for (int k = 0; k < repeat; k++) {
+        memset(&t, 0, sizeof(t));
+        end = scan_file(data, (size_t)st.st_size, player, &t);
+    }
+    double elapsed = (now_sec() - start) / repeat;
+    // O servidor descarta esse resto ao reabrir o arquivo
+    if (end < (size_t)st.st_size) fprintf(stderr, "Aviso: %zu bytes incompletos no fim do arquivo ignorados.\n", (size_t)st.st_size - end);
+
+    printf("Partidas: %llu (%llu no modo salvo)\n", t.games, t.salvo);
+    if (t.games > 0) {
+        printf("Vitorias: jogador 1 %llu (%.1f%%), jogador 2 %llu (%.1f%%)\n", t.wins[0],
+               100.0 * t.wins[0] / t.games, t.wins[1], 100.0 * t.wins[1] / t.games);
+        printf("Duracao: media %.3f s, maxima %.3f s; turnos por partida: %.1f\n",
+               t.duration_sum / 1000.0 / t.games, t.duration_max / 1000.0, (double)t.turns_sum / t.games);
+        printf("Tiros: %llu, acertos: %llu (%.1f%%)\n", t.shots, t.hits, t.shots ? 100.0 * t.hits / t.shots : 0.0);
+        printf("Primeiro navio afundado:");
+        for (int s = 0; s < SHIP_TYPES; s++) printf(" %s %llu", ship_names[s], t.first_sunk[s]);
+        printf("\n");
+    }
+    if (player) printf("%s: %llu vitorias, %llu derrotas\n", player, t.player_wins, t.player_losses);
+    printf("Varredura: %.3f ms, %.1f milhoes de partidas/s (%.1f MB)\n", elapsed * 1000.0,
+           elapsed > 0 ? t.games / elapsed / 1e6 : 0.0, st.st_size / 1048576.0);
+
+    munmap((void *)data, (size_t)st.st_size);
+    return 0;
+}
@@ -0,0 +1,620 @@
+// Teste de resistencia (soak) do servidor de Batalha Naval.
+//
+// Joga partidas completas em sequencia, com varias partidas simultaneas, e derruba de
+// proposito uma parte delas em todas as fases (antes do JOIN, no lobby, no posicionamento,
+// esperando o adversario ficar pronto, na vez de jogar, esperando a vez e logo apos um
+// FIRE, ou depois do fim, com a revanche pedida ou ja aceita), fechando com FIN ou com RST. Ao fim de cada rodada, com o servidor ocioso, mede
+// RSS, descritores abertos e threads do processo e a latencia das partidas completas.
+// Falha (codigo de saida 1) se algum desses valores crescer ao longo das rodadas ou se o
+// servidor deixar o jogador que ficou na partida sem resposta.
+//
+// Com --salvo o servidor roda no modo salvo e o jogador que acerta dispara varias casas por FIRE.
+//
+// Uso: bench/soak [--rounds N] [--games N] [--conc N] [--abort-pct P] [--warmup N] [--salvo]
+//                 [--rss-slack KB] [--settle S] [--server caminho | --pid PID] [-- opcoes do servidor]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/tcp.h>
+
+#include "../common/protocol.h"
+#include "../server/lobby.h"
+
+#define PLAYERS_PER_GAME 2
+#define IO_TIMEOUT_MS 10000 // Tempo maximo esperando uma linha do servidor
+#define MAX_ROUNDS 10000
+#define MAX_ERRORS_REPORTED 20
+#define SALVO_SHOTS 3 // Tiros por salva do jogador 0 (a partida ainda passa por varios turnos)
+
+// Fase em que uma partida e derrubada
+typedef enum {
+    ABORT_NONE = 0,
+    ABORT_BEFORE_JOIN,  // Conecta e fecha sem JOIN
+    ABORT_IN_LOBBY,     // JOIN em sala vazia e fecha antes do adversario chegar
+    ABORT_PLACEMENT,    // Fecha no meio do posicionamento
+    ABORT_READY_WAIT,   // READY e fecha enquanto o adversario ainda posiciona
+    ABORT_ON_TURN,      // Fecha na propria vez, sem atirar
+    ABORT_WAITING_TURN, // Fecha enquanto espera a vez (o servidor nao esta lendo o socket)
+    ABORT_AFTER_FIRE,   // Envia FIRE e fecha em seguida
+    ABORT_REMATCH,      // Fim com vencedor, o adversario pede REMATCH e a vitima fecha (antes ou depois de aceitar)
+    ABORT_KINDS
+} AbortKind;
+
+static const char *abort_names[ABORT_KINDS] = {
+    "completa", "antes_join", "lobby", "posicionamento", "espera_pronto", "na_vez", "esperando_vez", "apos_fire", "revanche"
+};
+
+typedef enum { GAME_OK, GAME_ABORTED, GAME_ERROR, GAME_STUCK } GameResult;
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[1024];
+} SoakConn;
+
+typedef struct {
+    int id;
+    int games;
+    unsigned seed;
+    unsigned long serial; // Numero da proxima partida deste jogador virtual (nomes unicos)
+    // Resultados da rodada
+    double *latency_ms;   // Duracao das partidas completas
+    int latency_count;
+    int aborted[ABORT_KINDS];
+    int errors;
+    int stuck;
+} Driver;
+
+typedef struct {
+    long rss_kb;
+    int fds;
+    int threads;
+} ProcSample;
+
+static const int ship_pos[MAX_SHIPS][2] = { {0, 0}, {2, 0}, {4, 0}, {6, 0} };
+static const char *ship_cmd[MAX_SHIPS] = { "S", "F", "F", "D" };
+static const int ship_cells[][2] = { {0, 0}, {2, 0}, {2, 1}, {4, 0}, {4, 1}, {6, 0}, {6, 1}, {6, 2} };
+#define FLEET_CELLS (int)(sizeof(ship_cells) / sizeof(ship_cells[0]))
+
+static int abort_pct = 30;
+static int salvo = 0; // --salvo: servidor no modo salvo, o jogador 0 atira SALVO_SHOTS casas por vez
+
+// --- Conexoes ---
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static int conn_open(SoakConn *c) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(PORT) };
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    c->len = 0;
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Fecha a conexao. Com rst, o fechamento e abrupto (SO_LINGER 0) e nao deixa TIME_WAIT.
+static void conn_close(SoakConn *c, int rst) {
+    if (c->fd < 0) return;
+    if (rst) {
+        struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(c->fd);
+    c->fd = -1;
+}
+
+static int conn_send(SoakConn *c, const char *cmd) {
+    char line[MAX_MSG];
+    int len = snprintf(line, sizeof(line), "%s\n", cmd);
+    return send(c->fd, line, (size_t)len, MSG_NOSIGNAL) == len ? 0 : -1;
+}
+
+// Le uma linha do servidor. Retorna 1 com uma linha, 0 no fim da conexao, -1 em timeout.
+static int conn_read_line(SoakConn *c, char *line, size_t size) {
+    while (1) {
+        char *nl = memchr(c->buf, '\n', c->len);
+        if (nl) {
+            size_t n = (size_t)(nl - c->buf);
+            size_t copy = n < size - 1 ? n : size - 1;
+            memcpy(line, c->buf, copy);
+            line[copy] = '\0';
+            c->len -= n + 1;
+            memmove(c->buf, nl + 1, c->len);
+            return 1;
+        }
+        if (c->len == sizeof(c->buf)) c->len = 0; // Linha longa demais: descarta
+
+        struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+        if (poll(&pfd, 1, IO_TIMEOUT_MS) <= 0) return -1;
+        ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+        if (r <= 0) return 0;
+        c->len += (size_t)r;
+    }
+}
+
+// Le linhas ate encontrar uma que contenha um dos tokens (lista terminada em NULL).
+// Retorna o indice do token, -1 no fim da conexao ou -2 em timeout.
+static int conn_wait_for(SoakConn *c, const char *const *tokens) {
+    char line[MAX_MSG * 2];
+    while (1) {
+        int r = conn_read_line(c, line, sizeof(line));
+        if (r == 0) return -1;
+        if (r < 0) return -2;
+        for (int i = 0; tokens[i]; i++) {
+            if (strstr(line, tokens[i])) return i;
+        }
+    }
+}
+
+static int conn_expect(SoakConn *c, const char *token) {
+    const char *tokens[] = { token, NULL };
+    return conn_wait_for(c, tokens) == 0 ? 0 : -1;
+}
+
+// --- Partidas ---
+
+// Depois de derrubar a vitima, o jogador que ficou tem de ser avisado e liberado pelo
+// servidor: recebe END (REMATCH_ERRO depois do fim) ou o fim da conexao. Sem resposta, a
+// partida ficou presa.
+static GameResult finish_abort(Driver *d, SoakConn *victim, SoakConn *survivor, AbortKind kind, int rst) {
+    conn_close(victim, rst);
+    if (survivor) {
+        const char *tokens[] = { CMD_END, CMD_REMATCH_ERRO, NULL };
+        int r = conn_wait_for(survivor, tokens);
+        conn_close(survivor, 1);
+        if (r == -2) {
+            d->stuck++;
+            return GAME_STUCK;
+        }
+    }
+    d->aborted[kind]++;
+    return GAME_ABORTED;
+}
+
+static int errors_reported = 0;
+
+// Resposta inesperada do servidor. As primeiras sao descritas para facilitar a investigacao.
+static GameResult game_error(Driver *d, SoakConn *a, SoakConn *b, AbortKind kind, const char *step) {
+    if (__atomic_fetch_add(&errors_reported, 1, __ATOMIC_RELAXED) < MAX_ERRORS_REPORTED) {
+        fprintf(stderr, "erro: jogador virtual %d, partida %lu (%s): %s\n", d->id, d->serial - 1, abort_names[kind], step);
+    }
+    conn_close(a, 1);
+    conn_close(b, 1);
+    d->errors++;
+    return GAME_ERROR;
+}
+
+static int join(SoakConn *c, const char *name, const char *room) {
+    char cmd[MAX_MSG];
+    if (conn_open(c) < 0 || conn_expect(c, "Conectado") < 0) return -1;
+    snprintf(cmd, sizeof(cmd), "%s %s %s", CMD_JOIN, name, room);
+    if (conn_send(c, cmd) < 0 || conn_expect(c, CMD_JOIN_OK) < 0) return -1;
+    return 0;
+}
+
+// Joga uma partida. O jogador 0 acerta todos os navios; o jogador 1 so erra.
+// kind/victim/rst escolhem se, onde e como um dos dois abandona a partida.
+static GameResult play_game(Driver *d, AbortKind kind, int victim, int rst) {
+    SoakConn p[PLAYERS_PER_GAME] = { { .fd = -1 }, { .fd = -1 } };
+    char name[PLAYERS_PER_GAME][NAME_MAX_LEN], room[ROOM_NAME_LEN], cmd[MAX_MSG];
+    unsigned long serial = d->serial++;
+    double start = now_ms();
+
+    snprintf(room, sizeof(room), "k%dg%lu", d->id, serial);
+    snprintf(name[0], sizeof(name[0]), "k%dg%lua", d->id, serial);
+    snprintf(name[1], sizeof(name[1]), "k%dg%lub", d->id, serial);
+
+    if (kind == ABORT_BEFORE_JOIN) {
+        if (conn_open(&p[0]) < 0 || conn_expect(&p[0], "Conectado") < 0) return game_error(d, &p[0], &p[1], kind, "conexao");
+        return finish_abort(d, &p[0], NULL, kind, rst);
+    }
+    if (join(&p[0], name[0], room) < 0) return game_error(d, &p[0], &p[1], kind, "JOIN do jogador 0");
+    if (kind == ABORT_IN_LOBBY) return finish_abort(d, &p[0], NULL, kind, rst);
+    if (join(&p[1], name[1], room) < 0) return game_error(d, &p[0], &p[1], kind, "JOIN do jogador 1");
+
+    SoakConn *v = &p[victim], *s = &p[1 - victim];
+
+    // Posicionamento, alternando os jogadores
+    for (int i = 0; i < MAX_SHIPS; i++) {
+        for (int j = 0; j < PLAYERS_PER_GAME; j++) {
+            if (kind == ABORT_PLACEMENT && j == victim && i == 2) return finish_abort(d, v, s, kind, rst);
+            snprintf(cmd, sizeof(cmd), "%s %s %d %d H", CMD_POS, ship_cmd[i], ship_pos[i][0], ship_pos[i][1]);
+            if (conn_send(&p[j], cmd) < 0 || conn_expect(&p[j], "sucesso") < 0) return game_error(d, &p[0], &p[1], kind, "POS");
+        }
+    }
+
+    if (kind == ABORT_READY_WAIT) {
+        if (conn_send(v, CMD_READY) < 0 || conn_expect(v, "READY recebido") < 0) return game_error(d, &p[0], &p[1], kind, "READY");
+        return finish_abort(d, v, s, kind, rst);
+    }
+    for (int j = 0; j < PLAYERS_PER_GAME; j++) {
+        if (conn_send(&p[j], CMD_READY) < 0) return game_error(d, &p[0], &p[1], kind, "READY");
+    }
+    for (int j = 0; j < PLAYERS_PER_GAME; j++) {
+        if (conn_expect(&p[j], "INICIO") < 0) return game_error(d, &p[0], &p[1], kind, "INICIO");
+    }
+
+    // Jogo: o jogador 0 comeca
+    const char *shooter_tokens[] = { "AGUARDE", CMD_WIN, NULL };
+    const char *waiter_tokens[] = { CMD_PLAY, CMD_LOSE, NULL };
+    int shots[PLAYERS_PER_GAME] = { 0, 0 };
+    int turn = 0;
+    for (int shooter = 0;; shooter = 1 - shooter, turn++) {
+        int waiter = 1 - shooter;
+        if (turn >= 2) { // Aborta depois de alguns turnos normais, no papel sorteado
+            if (kind == ABORT_ON_TURN && shooter == victim) return finish_abort(d, v, s, kind, rst);
+            if (kind == ABORT_WAITING_TURN && waiter == victim) return finish_abort(d, v, s, kind, rst);
+        }
+
+        // O jogador 1 so erra, entao o 0 sempre tem os quatro navios inteiros para a salva
+        int n_shots = (salvo && shooter == 0) ? SALVO_SHOTS : 1;
+        if (shooter == 0 && n_shots > FLEET_CELLS - shots[0]) n_shots = FLEET_CELLS - shots[0];
+        size_t len = (size_t)snprintf(cmd, sizeof(cmd), "%s", CMD_FIRE);
+        for (int k = 0; k < n_shots; k++) {
+            int x, y;
+            if (shooter == 0) {
+                x = ship_cells[shots[0]][0];
+                y = ship_cells[shots[0]][1];
+            } else {
+                x = (shots[1] < BOARD_SIZE) ? 7 : 5; // Linhas sem navios
+                y = shots[1] % BOARD_SIZE;
+            }
+            shots[shooter]++;
+            len += (size_t)snprintf(cmd + len, sizeof(cmd) - len, " %d %d", x, y);
+        }
+        if (conn_send(&p[shooter], cmd) < 0) return game_error(d, &p[0], &p[1], kind, "FIRE");
+        if (turn >= 2 && kind == ABORT_AFTER_FIRE && shooter == victim) return finish_abort(d, v, s, kind, rst);
+
+        int rs = conn_wait_for(&p[shooter], shooter_tokens);
+        int rw = conn_wait_for(&p[waiter], waiter_tokens);
+        if (rs < 0 || rw < 0 || rs != rw) return game_error(d, &p[0], &p[1], kind, "resultado do turno");
+        if (rs == 1) break; // WIN / LOSE
+    }
+
+    // Fim normal: os dois recebem END
+    for (int j = 0; j < PLAYERS_PER_GAME; j++) {
+        if (conn_expect(&p[j], CMD_END) < 0) return game_error(d, &p[0], &p[1], kind, "END");
+    }
+    if (kind == ABORT_REMATCH) {
+        // O outro jogador pede revanche; em metade das partidas a vitima tambem pede (a partida
+        // volta ao posicionamento) e fecha em seguida, na outra metade fecha sem responder
+        if (conn_send(s, CMD_REMATCH) < 0) return game_error(d, &p[0], &p[1], kind, "REMATCH");
+        if (serial % 2 == 0) {
+            if (conn_send(v, CMD_REMATCH) < 0 || conn_expect(v, CMD_REMATCH_OK) < 0 || conn_expect(s, CMD_REMATCH_OK) < 0) {
+                return game_error(d, &p[0], &p[1], kind, "REMATCH_OK");
+            }
+        }
+        return finish_abort(d, v, s, kind, rst);
+    }
+    for (int j = 0; j < PLAYERS_PER_GAME; j++) conn_close(&p[j], 1);
+    d->latency_ms[d->latency_count++] = now_ms() - start;
+    return GAME_OK;
+}
+
+static void *driver_main(void *arg) {
+    Driver *d = arg;
+    for (int i = 0; i < d->games; i++) {
+        AbortKind kind = ABORT_NONE;
+        if ((int)(rand_r(&d->seed) % 100) < abort_pct) {
+            kind = (AbortKind)(1 + rand_r(&d->seed) % (ABORT_KINDS - 1));
+        }
+        int victim = rand_r(&d->seed) % PLAYERS_PER_GAME;
+        int rst = rand_r(&d->seed) % 2;
+        play_game(d, kind, victim, rst);
+    }
+    return NULL;
+}
+
+// --- Amostras do processo servidor ---
+
+static int sample_process(pid_t pid, ProcSample *out) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    out->rss_kb = -1;
+    out->threads = -1;
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "VmRSS: %ld", &out->rss_kb);
+        sscanf(line, "Threads: %d", &out->threads);
+    }
+    fclose(f);
+
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+    DIR *dir = opendir(path);
+    if (!dir) return -1;
+    out->fds = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] != '.') out->fds++;
+    }
+    closedir(dir);
+    return 0;
+}
+
+// Espera o servidor voltar ao repouso (threads e descritores da linha de base), ate settle_s
+static int sample_idle(pid_t pid, const ProcSample *base, int settle_s, ProcSample *out) {
+    double deadline = now_ms() + settle_s * 1000.0;
+    while (1) {
+        if (sample_process(pid, out) < 0) return -1;
+        if (!base || (out->threads <= base->threads && out->fds <= base->fds) || now_ms() > deadline) return 0;
+        usleep(50 * 1000);
+    }
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double *v, int n, double p) {
+    if (n == 0) return 0;
+    int idx = (int)(p * (n - 1) + 0.5);
+    return v[idx];
+}
+
+static double median_of(double *v, int n) {
+    double tmp[MAX_ROUNDS];
+    memcpy(tmp, v, sizeof(double) * (size_t)n);
+    qsort(tmp, (size_t)n, sizeof(double), cmp_double);
+    return percentile(tmp, n, 0.5);
+}
+
+// --- Servidor ---
+
+static int port_in_use(void) {
+    SoakConn c;
+    if (conn_open(&c) < 0) return 0;
+    conn_close(&c, 1);
+    return 1;
+}
+
+static pid_t launch_server(const char *path, char **extra, int extra_count) {
+    char *args[64];
+    int n = 0;
+    args[n++] = (char *)path;
+    args[n++] = "--ratings";
+    args[n++] = "none";
+    args[n++] = "--ip-rate";
+    args[n++] = "0";
+    if (salvo) args[n++] = "--salvo";
+    for (int i = 0; i < extra_count && n < 63; i++) args[n++] = extra[i];
+    args[n] = NULL;
+
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+        execv(path, args);
+        perror("execv");
+        _exit(127);
+    }
+
+    // Espera a porta aceitar conexoes
+    for (int i = 0; i < 100; i++) {
+        usleep(50 * 1000);
+        if (waitpid(pid, NULL, WNOHANG) == pid) return -1;
+        if (port_in_use()) return pid;
+    }
+    kill(pid, SIGTERM);
+    return -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [--rounds N] [--games N] [--conc N] [--abort-pct P] [--warmup N] [--salvo]\n"
+            "          [--rss-slack KB] [--settle S] [--server caminho | --pid PID] [-- opcoes do servidor]\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int rounds = 20, games = 200, conc = 16, warmup = 2, settle_s = 5;
+    long rss_slack_kb = 1024;
+    const char *server_path = "./server/battleserver";
+    pid_t pid = 0;
+    int launched = 0;
+    char **extra = NULL;
+    int extra_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            extra = &argv[i + 1];
+            extra_count = argc - i - 1;
+            break;
+        } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+            games = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--conc") == 0 && i + 1 < argc) {
+            conc = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--abort-pct") == 0 && i + 1 < argc) {
+            abort_pct = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--salvo") == 0) {
+            salvo = 1;
+        } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rss-slack") == 0 && i + 1 < argc) {
+            rss_slack_kb = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--settle") == 0 && i + 1 < argc) {
+            settle_s = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            server_path = argv[++i];
+        } else if (strcmp(argv[i], "--pid") == 0 && i + 1 < argc) {
+            pid = (pid_t)atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 1 || rounds > MAX_ROUNDS || games < 1 || conc < 1 || warmup < 0 || warmup >= rounds) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (conc > games) conc = games;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (pid == 0) {
+        if (port_in_use()) {
+            fprintf(stderr, "Porta %d ja esta em uso. Encerre o servidor ou use --pid.\n", PORT);
+            return 2;
+        }
+        pid = launch_server(server_path, extra, extra_count);
+        if (pid < 0) {
+            fprintf(stderr, "Nao foi possivel iniciar %s.\n", server_path);
+            return 2;
+        }
+        launched = 1;
+    }
+
+    ProcSample base;
+    if (sample_idle(pid, NULL, 0, &base) < 0) {
+        fprintf(stderr, "Nao foi possivel ler /proc/%d.\n", (int)pid);
+        return 2;
+    }
+    printf("Servidor pid %d em repouso: RSS %ld KB, %d fds, %d threads\n", (int)pid, base.rss_kb, base.fds, base.threads);
+    printf("%d rodadas x %d partidas, %d simultaneas, %d%% derrubadas\n", rounds, games, conc, abort_pct);
+
+    Driver *drivers = calloc((size_t)conc, sizeof(Driver));
+    pthread_t *threads = calloc((size_t)conc, sizeof(pthread_t));
+    double *all_latency = malloc(sizeof(double) * (size_t)games);
+    ProcSample samples[MAX_ROUNDS];
+    double p99s[MAX_ROUNDS];
+    double rss_kb[MAX_ROUNDS];
+    long total_games = 0;
+    int total_errors = 0, total_stuck = 0;
+
+    for (int d = 0; d < conc; d++) {
+        drivers[d].id = d;
+        drivers[d].seed = 12345u + (unsigned)d;
+        drivers[d].latency_ms = malloc(sizeof(double) * (size_t)(games / conc + 1));
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        double round_start = now_ms();
+        for (int d = 0; d < conc; d++) {
+            Driver *drv = &drivers[d];
+            drv->games = games / conc + (d < games % conc ? 1 : 0);
+            drv->latency_count = 0;
+            drv->errors = 0;
+            drv->stuck = 0;
+            memset(drv->aborted, 0, sizeof(drv->aborted));
+            pthread_create(&threads[d], NULL, driver_main, drv);
+        }
+
+        int aborted[ABORT_KINDS] = {0};
+        int lat_count = 0, round_errors = 0, round_stuck = 0;
+        for (int d = 0; d < conc; d++) {
+            pthread_join(threads[d], NULL);
+            memcpy(all_latency + lat_count, drivers[d].latency_ms, sizeof(double) * (size_t)drivers[d].latency_count);
+            lat_count += drivers[d].latency_count;
+            round_errors += drivers[d].errors;
+            round_stuck += drivers[d].stuck;
+            for (int k = 0; k < ABORT_KINDS; k++) aborted[k] += drivers[d].aborted[k];
+        }
+        double elapsed = now_ms() - round_start;
+        total_games += games;
+        total_errors += round_errors;
+        total_stuck += round_stuck;
+
+        if (sample_idle(pid, &base, settle_s, &samples[r]) < 0) {
+            fprintf(stderr, "FALHA: o servidor (pid %d) terminou.\n", (int)pid);
+            return 1;
+        }
+        qsort(all_latency, (size_t)lat_count, sizeof(double), cmp_double);
+        p99s[r] = percentile(all_latency, lat_count, 0.99);
+        rss_kb[r] = (double)samples[r].rss_kb;
+
+        int aborted_total = 0;
+        for (int k = 1; k < ABORT_KINDS; k++) aborted_total += aborted[k];
+        printf("rodada %3d: %ld partidas (%.0f/s), %d derrubadas, %d erros, %d presas | RSS %ld KB, %d fds, %d threads | partida p50 %.1f ms p99 %.1f ms\n",
+               r + 1, total_games, games * 1000.0 / elapsed, aborted_total, round_errors, round_stuck,
+               samples[r].rss_kb, samples[r].fds, samples[r].threads,
+               percentile(all_latency, lat_count, 0.5), p99s[r]);
+        fflush(stdout);
+    }
+
+    // Veredito: compara o inicio (apos o aquecimento) com o ultimo terco das rodadas
+    int failed = 0;
+    int measured = rounds - warmup;
+    int third = measured / 3 > 0 ? measured / 3 : 1;
+    ProcSample *last = &samples[rounds - 1];
+    double rss_first = median_of(&rss_kb[warmup], third);
+    double rss_last = median_of(&rss_kb[rounds - third], third);
+    double p99_first = median_of(&p99s[warmup], third);
+    double p99_last = median_of(&p99s[rounds - third], third);
+
+    printf("\nAbortos por fase (ultima rodada):");
+    for (int k = 1; k < ABORT_KINDS; k++) {
+        int sum = 0;
+        for (int d = 0; d < conc; d++) sum += drivers[d].aborted[k];
+        printf(" %s=%d", abort_names[k], sum);
+    }
+    printf("\n");
+
+    if (last->fds > base.fds) {
+        printf("FALHA: descritores abertos em repouso cresceram de %d para %d.\n", base.fds, last->fds);
+        failed = 1;
+    }
+    if (last->threads > base.threads) {
+        printf("FALHA: threads em repouso cresceram de %d para %d.\n", base.threads, last->threads);
+        failed = 1;
+    }
+    if (rss_last > rss_first + rss_slack_kb) {
+        printf("FALHA: RSS cresceu de %.0f KB para %.0f KB (tolerancia %ld KB).\n", rss_first, rss_last, rss_slack_kb);
+        failed = 1;
+    }
+    if (p99_last > 2 * p99_first + 5.0) {
+        printf("FALHA: p99 por partida cresceu de %.1f ms para %.1f ms.\n", p99_first, p99_last);
+        failed = 1;
+    }
+    if (total_stuck > 0) {
+        printf("FALHA: %d partidas deixaram o jogador restante sem resposta.\n", total_stuck);
+        failed = 1;
+    }
+    if (total_errors > 0) {
+        printf("FALHA: %d partidas com resposta inesperada do servidor.\n", total_errors);
+        failed = 1;
+    }
+    if (!failed) {
+        printf("OK: %ld partidas; RSS %.0f -> %.0f KB, fds %d, threads %d, p99 %.1f -> %.1f ms.\n",
+               total_games, rss_first, rss_last, last->fds, last->threads, p99_first, p99_last);
+    }
+
+    if (launched) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+    for (int d = 0; d < conc; d++) free(drivers[d].latency_ms);
+    free(drivers);
+    free(threads);
+    free(all_latency);
+    return failed;
+}
@@ -1,30 +1,261 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <ctype.h> // Para toupper
+#include <sys/ioctl.h>
 
 #include "../common/protocol.h" 
+#include "../common/state.h"
+
+// --- Desenho dos tabuleiros ---
+// Cada quadro e montado em memoria e vai para o terminal com um unico write(), em vez de um
+// printf por casa. No modo ANSI (--ansi) os dois tabuleiros ficam fixos no topo da tela e
+// so as casas que mudaram sao redesenhadas; as mensagens rolam em uma regiao abaixo deles.
+
+#define TAM_QUADRO 16384
+#define LARGURA_CASA (BOARD_SIZE > 9 ? 3 : 2)              // Casa + espaco (numeros de 2 digitos)
+#define PAINEL_LINHAS (BOARD_SIZE + 3)                     // Titulos, cabecalho, linhas e separador
+#define PAINEL_COL_ADV (2 + BOARD_SIZE * LARGURA_CASA + 6) // Coluna do tabuleiro do adversario
+
+typedef struct {
+    char dados[TAM_QUADRO];
+    size_t len;
+} Quadro;
+
+static Quadro quadro;
+static int modo_ansi = 0;
+static int painel_desenhado = 0;
+static char desenhado[2][BOARD_SIZE][BOARD_SIZE]; // O que esta na tela em cada tabuleiro (modo ANSI)
+
+static void quadro_add(Quadro *q, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(q->dados + q->len, sizeof(q->dados) - q->len, fmt, args);
+    va_end(args);
+    if (n > 0) q->len += ((size_t)n < sizeof(q->dados) - q->len) ? (size_t)n : sizeof(q->dados) - q->len - 1;
+}
+
+static void quadro_char(Quadro *q, char c) {
+    if (q->len < sizeof(q->dados) - 1) q->dados[q->len++] = c;
+}
+
+// Envia o quadro inteiro de uma vez. O stdout e esvaziado antes para manter a ordem com printf.
+static void quadro_enviar(Quadro *q) {
+    fflush(stdout);
+    size_t enviado = 0;
+    while (enviado < q->len) {
+        ssize_t n = write(STDOUT_FILENO, q->dados + enviado, q->len - enviado);
+        if (n <= 0) break;
+        enviado += (size_t)n;
+    }
+    q->len = 0;
+}
+
+static void quadro_cabecalho(Quadro *q) {
+    quadro_add(q, "  ");
+    for (int j = 0; j < BOARD_SIZE; j++) quadro_add(q, "%-*d", LARGURA_CASA, j + 1);
+}
+
+static void quadro_linha(Quadro *q, char tab[BOARD_SIZE][BOARD_SIZE], int i) {
+    quadro_char(q, 'A' + i);
+    quadro_char(q, ' ');
+    for (int j = 0; j < BOARD_SIZE; j++) {
+        quadro_char(q, tab[i][j]);
+        for (int k = 1; k < LARGURA_CASA; k++) quadro_char(q, ' ');
+    }
+}
+
+static void quadro_tabuleiro(Quadro *q, char tab[BOARD_SIZE][BOARD_SIZE]) {
+    quadro_cabecalho(q);
+    quadro_char(q, '\n');
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        quadro_linha(q, tab, i);
+        quadro_char(q, '\n');
+    }
+}
+
+// Modo ANSI: limpa a tela, desenha os dois tabuleiros no topo e restringe a rolagem as
+// linhas abaixo deles
+static void painel_desenhar(char meu[BOARD_SIZE][BOARD_SIZE], char adv[BOARD_SIZE][BOARD_SIZE], int altura) {
+    Quadro *q = &quadro;
+    quadro_add(q, "\033[2J\033[1;1HSeu tabuleiro\033[1;%dHAdversario (seus tiros)", PAINEL_COL_ADV);
+    quadro_add(q, "\033[2;1H");
+    quadro_cabecalho(q);
+    quadro_add(q, "\033[2;%dH", PAINEL_COL_ADV);
+    quadro_cabecalho(q);
+    for (int i = 0; i < BOARD_SIZE; i++) {
+        quadro_add(q, "\033[%d;1H", 3 + i);
+        quadro_linha(q, meu, i);
+        quadro_add(q, "\033[%d;%dH", 3 + i, PAINEL_COL_ADV);
+        quadro_linha(q, adv, i);
+    }
+    quadro_add(q, "\033[%d;1H", PAINEL_LINHAS);
+    for (int j = 0; j < PAINEL_COL_ADV + 2 + BOARD_SIZE * LARGURA_CASA; j++) quadro_char(q, '-');
+    // A regiao de rolagem leva o cursor para o inicio: reposiciona na primeira linha dela
+    quadro_add(q, "\033[%d;%dr\033[%d;1H", PAINEL_LINHAS + 1, altura, PAINEL_LINHAS + 1);
+    quadro_enviar(q);
+
+    memcpy(desenhado[0], meu, sizeof(desenhado[0]));
+    memcpy(desenhado[1], adv, sizeof(desenhado[1]));
+    painel_desenhado = 1;
+}
+
+// Modo ANSI: redesenha so as casas diferentes do que ja esta na tela, sem mexer no cursor
+// da regiao de mensagens
+static void painel_atualizar(char meu[BOARD_SIZE][BOARD_SIZE], char adv[BOARD_SIZE][BOARD_SIZE]) {
+    Quadro *q = &quadro;
+    char (*tabs[2])[BOARD_SIZE] = { meu, adv };
+    quadro_add(q, "\0337"); // Salva o cursor
+    size_t vazio = q->len;
+    for (int t = 0; t < 2; t++) {
+        int coluna = (t == 0) ? 1 : PAINEL_COL_ADV;
+        for (int i = 0; i < BOARD_SIZE; i++) {
+            for (int j = 0; j < BOARD_SIZE; j++) {
+                if (tabs[t][i][j] == desenhado[t][i][j]) continue;
+                quadro_add(q, "\033[%d;%dH%c", 3 + i, coluna + 2 + j * LARGURA_CASA, tabs[t][i][j]);
+                desenhado[t][i][j] = tabs[t][i][j];
+            }
+        }
+    }
+    if (q->len == vazio) { // Nada mudou: nenhum byte vai para o terminal
+        q->len = 0;
+        return;
+    }
+    quadro_add(q, "\0338"); // Restaura o cursor
+    quadro_enviar(q);
+}
 
-void imprimir_tabuleiro(char tab[BOARD_SIZE][BOARD_SIZE]) {
-    printf("  1 2 3 4 5 6 7 8\n");
+// Mostra o proprio tabuleiro e, se titulo_adv nao for NULL, o do adversario, em um unico quadro
+void mostrar_tabuleiros(char meu[BOARD_SIZE][BOARD_SIZE], char adv[BOARD_SIZE][BOARD_SIZE], const char *titulo_adv) {
+    if (modo_ansi) {
+        if (painel_desenhado) {
+            painel_atualizar(meu, adv);
+        } else {
+            struct winsize ws;
+            int altura = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0) ? ws.ws_row : 24;
+            painel_desenhar(meu, adv, altura);
+        }
+        return;
+    }
+    quadro_add(&quadro, "Seu tabuleiro:\n");
+    quadro_tabuleiro(&quadro, meu);
+    if (titulo_adv) {
+        quadro_add(&quadro, "\n%s:\n", titulo_adv);
+        quadro_tabuleiro(&quadro, adv);
+    }
+    quadro_enviar(&quadro);
+}
+
+// Devolve a rolagem da tela inteira ao terminal ao sair (modo ANSI)
+static void restaurar_terminal(void) {
+    if (!painel_desenhado) return;
+    fflush(stdout);
+    quadro_add(&quadro, "\033[r\033[999;1H\n");
+    quadro_enviar(&quadro);
+}
+
+// Bytes do servidor que chegaram antes da resposta a um STATE (OPPONENT_FIRE, PLAY...). Sao
+// entregues por receber() antes de qualquer recv novo, na ordem em que chegaram.
+static char pendentes[MAX_MSG * 4];
+static size_t pendentes_len = 0;
+
+static void guardar_pendentes(const char *dados, size_t len) {
+    if (len > sizeof(pendentes) - pendentes_len) len = sizeof(pendentes) - pendentes_len; // Sem espaco: descarta o resto
+    memcpy(pendentes + pendentes_len, dados, len);
+    pendentes_len += len;
+}
+
+// recv do socket que antes devolve o que ressincronizar guardou, uma linha por chamada (os
+// loops de posicionamento tratam so a primeira linha de cada recv)
+static ssize_t receber(int sock, char *buf, size_t cap) {
+    if (pendentes_len == 0) return recv(sock, buf, cap, 0);
+    char *fim = memchr(pendentes, '\n', pendentes_len);
+    size_t n = fim ? (size_t)(fim - pendentes) + 1 : pendentes_len;
+    if (n > cap) n = cap;
+    memcpy(buf, pendentes, n);
+    memmove(pendentes, pendentes + n, pendentes_len - n);
+    pendentes_len -= n;
+    return (ssize_t)n;
+}
+
+// Pede ao servidor o estado autoritativo da partida (STATE) e reconstroi os dois tabuleiros
+// locais a partir dele. Retorna 0 em sucesso, 1 se o servidor recusou o pedido e -1 se a
+// conexao caiu.
+int ressincronizar(int sock, char meu[BOARD_SIZE][BOARD_SIZE], char adv[BOARD_SIZE][BOARD_SIZE], GameState *st) {
+    send(sock, CMD_STATE, strlen(CMD_STATE), 0);
+
+    // A resposta e uma unica linha, mas pode chegar em mais de um pedaço e depois de mensagens
+    // que ja estavam a caminho: essas linhas ficam guardadas para o loop que chamou
+    char resposta[MAX_MSG] = {0};
+    size_t total = 0;
+    while (1) {
+        char *fim = memchr(resposta, '\n', total);
+        if (!fim) {
+            if (total == sizeof(resposta) - 1) return 1; // Linha maior que qualquer resposta
+            ssize_t n = recv(sock, resposta + total, sizeof(resposta) - 1 - total, 0); // Pendentes antigos seguem na frente
+            if (n <= 0) return -1;
+            total += (size_t)n;
+            resposta[total] = '\0';
+            continue;
+        }
+        size_t linha = (size_t)(fim - resposta) + 1;
+        if (strncmp(resposta, CMD_STATE " ", strlen(CMD_STATE) + 1) == 0 ||
+            strncmp(resposta, "Comando invalido", strlen("Comando invalido")) == 0) {
+            guardar_pendentes(resposta + linha, total - linha); // O que veio depois da resposta
+            *fim = '\0';
+            break;
+        }
+        guardar_pendentes(resposta, linha);
+        memmove(resposta, resposta + linha, total - linha);
+        total -= linha;
+        resposta[total] = '\0';
+    }
+
+    unsigned char bytes[STATE_BYTES];
+    if (strncmp(resposta, CMD_STATE " ", strlen(CMD_STATE) + 1) != 0 ||
+        state_from_hex(resposta + strlen(CMD_STATE) + 1, bytes) != 0) {
+        printf("Servidor: %s\n", resposta);
+        return 1;
+    }
+    state_unpack(bytes, st);
+
+    // Tiros recebidos (X/O) aparecem por cima dos navios, como durante o jogo
     for (int i = 0; i < BOARD_SIZE; i++) {
-        printf("%c ", 'A' + i);
         for (int j = 0; j < BOARD_SIZE; j++) {
-            printf("%c ", tab[i][j]);
+            meu[i][j] = (st->own_shots[i][j] != ' ') ? st->own_shots[i][j] : st->own_ships[i][j];
+            adv[i][j] = st->opp_shots[i][j];
         }
-        printf("\n");
     }
+
+    static const char *fases[] = { "posicionamento", "em jogo", "encerrada" };
+    printf("Estado sincronizado: partida %s%s, navios afundados: %d seus / %d do adversario\n",
+           fases[st->phase < 3 ? st->phase : 2],
+           (st->phase == STATE_PHASE_PLAYING && st->my_turn) ? " (sua vez)" : "",
+           st->sunk_by_me, st->sunk_by_opponent);
+    return 0;
 }
 
 int main(int argc, char const *argv[]) {
-    if (argc != 2) {
-        printf("Uso: %s <IP do Servidor>\n", argv[0]);
+    if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "--ansi") != 0)) {
+        printf("Uso: %s <IP do Servidor> [--ansi]\n", argv[0]);
         return 1;
     }
     const char *server_ip = argv[1];
 
+    // O modo ANSI precisa de um terminal com espaco para o painel e para as mensagens
+    if (argc == 3) {
+        struct winsize ws;
+        if (isatty(STDOUT_FILENO) && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row >= PAINEL_LINHAS + 6) {
+            modo_ansi = 1;
+            atexit(restaurar_terminal);
+        } else {
+            printf("Terminal sem suporte ou pequeno demais para --ansi: usando o modo normal.\n");
+        }
+    }
+
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     struct sockaddr_in serv_addr;
     char buffer[MAX_MSG] = {0};
@@ -52,7 +283,7 @@ int main(int argc, char const *argv[]) {
     }
 
     // Recebe a primeira mensagem do servidor (e.g., "Aguardando outro jogador..." ou "Conectado. Preparando...")
-    ssize_t n = recv(sock, buffer, sizeof(buffer)-1, 0);
+    ssize_t n = receber(sock, buffer, sizeof(buffer)-1);
     if (n <= 0) {
         printf("Conexão encerrada pelo servidor ou erro na recepção inicial.\n");
         close(sock);
@@ -68,16 +299,37 @@ int main(int argc, char const *argv[]) {
         return 0;
     }
 
-    printf("Digite seu nome: ");
-    fgets(nome, sizeof(nome), stdin);
-    nome[strcspn(nome, "\n")] = 0; // Remove a nova linha do nome
+    // Envia o comando JOIN ate o servidor aceitar o nome (ele recusa nomes ja em uso)
+    char sala[32];
+    while (1) {
+        printf("Digite seu nome: ");
+        fgets(nome, sizeof(nome), stdin);
+        nome[strcspn(nome, "\n")] = 0; // Remove a nova linha do nome
+        printf("Codigo da sala (vazio para partida publica): ");
+        fgets(sala, sizeof(sala), stdin);
+        sala[strcspn(sala, "\n")] = 0;
+
+        char join_msg[MAX_MSG];
+        snprintf(join_msg, sizeof(join_msg), "%s %s %s", CMD_JOIN, nome, sala);
+        send(sock, join_msg, strlen(join_msg), 0);
+
+        n = receber(sock, buffer, sizeof(buffer)-1);
+        if (n <= 0) {
+            printf("Conexão encerrada pelo servidor durante o JOIN.\n");
+            close(sock);
+            return 1;
+        }
+        buffer[n] = '\0';
+        buffer[strcspn(buffer, "\n")] = 0;
+        printf("Servidor: %s\n", buffer);
+        if (strncmp(buffer, CMD_JOIN_OK, strlen(CMD_JOIN_OK)) == 0) break;
+    }
 
-    // Envia o comando JOIN com o nome do jogador
-    char join_msg[MAX_MSG];
-    snprintf(join_msg, sizeof(join_msg), "%s %s", CMD_JOIN, nome);
-    send(sock, join_msg, strlen(join_msg), 0);
-    // Não espera resposta para JOIN, assume que foi bem-sucedido (o servidor já aceitou a conexão)
+    int teve_vencedor; // A partida terminou com WIN/LOSE: o servidor aceita REMATCH
+    int modo_salvo = 0; // Servidor com --salvo (avisado no INICIO DO JOGO): varios tiros por FIRE
 
+nova_partida: // Volta aqui na revanche, com a mesma conexao
+    teve_vencedor = 0;
     // --- Fase de Posicionamento ---
     printf("\n--- FASE DE POSICIONAMENTO ---\n");
     printf("Posicione seus navios no tabuleiro %dx%d\n", BOARD_SIZE, BOARD_SIZE);
@@ -94,9 +346,9 @@ int main(int argc, char const *argv[]) {
     while (!pronto_para_jogar) {
         printf("\nNavios restantes para posicionar: Submarino(%d/1), Fragata(%d/2), Destroyer(%d/1)\n",
                pos_submarino, pos_fragata, pos_destroyer);
-        printf("Seu tabuleiro:\n");
-        imprimir_tabuleiro(meu_tab);
-        printf("Digite comando %s ou %s para terminar posicionamento:\n", CMD_POS, CMD_READY);
+        mostrar_tabuleiros(meu_tab, tab_adversario, NULL);
+        printf("Digite comando %s ou %s para terminar posicionamento (%s [n] e %s [nome] consultam o ranking, %s ressincroniza):\n",
+               CMD_POS, CMD_READY, CMD_TOP, CMD_RATING, CMD_STATE);
         
         fgets(buffer, sizeof(buffer), stdin);
         buffer[strcspn(buffer, "\n")] = 0; // Remove a nova linha
@@ -111,7 +363,7 @@ int main(int argc, char const *argv[]) {
 
                 // Loop para esperar mensagens do servidor após READY
                 while (1) {
-                    n = recv(sock, buffer, sizeof(buffer)-1, 0); // Espera bloqueante
+                    n = receber(sock, buffer, sizeof(buffer)-1); // Espera bloqueante
                     if (n <= 0) {
                         printf("Servidor desconectado durante a espera pelo inicio do jogo ou erro.\n");
                         close(sock);
@@ -122,6 +374,7 @@ int main(int argc, char const *argv[]) {
                     printf("Servidor: %s\n", buffer); // Exibe a mensagem do servidor
 
                     if (strstr(buffer, "INICIO DO JOGO")) {
+                        modo_salvo = (strstr(buffer, "Modo salvo") != NULL);
                         pronto_para_jogar = 1; // Seta a flag para sair do loop externo de posicionamento
                         break; // Sai IMEDIATAMENTE do loop interno para processar a próxima mensagem (PLAY/AGUARDE) no loop principal
                     }
@@ -170,7 +423,7 @@ int main(int argc, char const *argv[]) {
                 send(sock, server_cmd, strlen(server_cmd), 0);
 
                 // Espera a resposta do servidor
-                n = recv(sock, buffer, sizeof(buffer)-1, 0);
+                n = receber(sock, buffer, sizeof(buffer)-1);
                 if (n <= 0) {
                     printf("Servidor desconectado durante o posicionamento.\n");
                     close(sock);
@@ -206,7 +459,72 @@ int main(int argc, char const *argv[]) {
                 printf("Comando POS invalido. Formato esperado: POS <TIPO/LETRA> <Coordenada> <O> (ex: POS F A1 H)\n");
             }
         }
-        // Se o comando não é POS nem READY
+        // Consulta o ranking persistente do servidor
+        else if (strncmp(buffer, CMD_TOP, strlen(CMD_TOP)) == 0) {
+            send(sock, buffer, strlen(buffer), 0);
+
+            // A resposta pode vir em varios pedaços: acumula até o marcador de fim
+            char resposta[MAX_MSG * 8] = {0};
+            size_t total = 0;
+            while (!strstr(resposta, CMD_TOP_FIM) && total < sizeof(resposta) - 1) {
+                n = receber(sock, resposta + total, sizeof(resposta) - 1 - total);
+                if (n <= 0) {
+                    printf("Servidor desconectado durante a consulta do ranking.\n");
+                    close(sock);
+                    return 1;
+                }
+                total += n;
+                resposta[total] = '\0';
+            }
+
+            printf("\n--- RANKING ---\n");
+            for (char *linha = strtok(resposta, "\n"); linha != NULL; linha = strtok(NULL, "\n")) {
+                int pos, elo;
+                unsigned vitorias, derrotas, afundados;
+                char nome_rank[50];
+                if (sscanf(linha, CMD_RANK " %d %49s %d %u %u %u", &pos, nome_rank, &elo, &vitorias, &derrotas, &afundados) == 6) {
+                    printf("%2d. %-20s %4d  (%uV/%uD, %u afundados)\n", pos, nome_rank, elo, vitorias, derrotas, afundados);
+                } else if (strcmp(linha, CMD_TOP_FIM) != 0) {
+                    printf("Servidor: %s\n", linha);
+                }
+            }
+        }
+        else if (strncmp(buffer, CMD_RATING, strlen(CMD_RATING)) == 0) {
+            send(sock, buffer, strlen(buffer), 0);
+            n = receber(sock, buffer, sizeof(buffer)-1);
+            if (n <= 0) {
+                printf("Servidor desconectado durante a consulta do rating.\n");
+                close(sock);
+                return 1;
+            }
+            buffer[n] = '\0';
+            buffer[strcspn(buffer, "\n")] = 0;
+            printf("Servidor: %s\n", buffer);
+        }
+        // Refaz o tabuleiro e os contadores locais a partir do estado guardado no servidor
+        else if (strcmp(buffer, CMD_STATE) == 0) {
+            GameState st;
+            int r = ressincronizar(sock, meu_tab, tab_adversario, &st);
+            if (r < 0) {
+                printf("Servidor desconectado durante a ressincronizacao.\n");
+                close(sock);
+                return 1;
+            }
+            if (r == 0) {
+                int casas_s = 0, casas_f = 0, casas_d = 0;
+                for (int i = 0; i < BOARD_SIZE; i++) {
+                    for (int j = 0; j < BOARD_SIZE; j++) {
+                        if (st.own_ships[i][j] == 'S') casas_s++;
+                        else if (st.own_ships[i][j] == 'F') casas_f++;
+                        else if (st.own_ships[i][j] == 'D') casas_d++;
+                    }
+                }
+                pos_submarino = casas_s;
+                pos_fragata = casas_f / 2;
+                pos_destroyer = casas_d / 3;
+            }
+        }
+        // Se o comando não é POS, READY, STATE ou consulta de ranking
         else {
             printf("Comando desconhecido ou invalido na fase de posicionamento. Use POS ou READY.\n");
         }
@@ -214,10 +532,7 @@ int main(int argc, char const *argv[]) {
 
     // --- Início da Fase de Jogo Principal ---
     printf("\n--- INICIO DO JOGO ---\n");
-    printf("Seu tabuleiro:\n");
-    imprimir_tabuleiro(meu_tab);
-    printf("\nTabuleiro do Adversario (seus tiros):\n");
-    imprimir_tabuleiro(tab_adversario);
+    mostrar_tabuleiros(meu_tab, tab_adversario, "Tabuleiro do Adversario (seus tiros)");
 
     int last_fire_x = -1, last_fire_y = -1; // Armazena o último tiro para atualizar o tabuleiro
 
@@ -231,7 +546,28 @@ int main(int argc, char const *argv[]) {
         char *command = strtok(buffer, "\n");
         while (command != NULL) {
             // A ordem aqui é crucial. Primeiro checa os comandos que podem conter outros como substring.
-            if (strstr(command, "OPPONENT_FIRE")) {
+            if (strncmp(command, CMD_OPPONENT_SALVO, strlen(CMD_OPPONENT_SALVO)) == 0 ||
+                strncmp(command, CMD_SALVO, strlen(CMD_SALVO)) == 0) {
+                // Resultado de uma salva: um trio <x> <y> <HIT|MISS|SUNK> por tiro
+                int recebida = (command[0] == 'O');
+                const char *p = command + (recebida ? strlen(CMD_OPPONENT_SALVO) : strlen(CMD_SALVO));
+                int x, y, usado;
+                char resultado[8];
+                while (sscanf(p, " %d %d %7s%n", &x, &y, resultado, &usado) == 3) {
+                    p += usado;
+                    if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) continue;
+                    char marca = (strcmp(resultado, CMD_MISS) == 0) ? 'O' : 'X';
+                    if (recebida) {
+                        meu_tab[x][y] = marca;
+                        printf("O adversario atirou em %c%d: %s\n", 'A' + x, y + 1, marca == 'X' ? "seu navio foi atingido!" : "agua.");
+                    } else {
+                        tab_adversario[x][y] = marca;
+                        printf("Tiro em %c%d: %s\n", 'A' + x, y + 1,
+                               strcmp(resultado, CMD_SUNK) == 0 ? "AFUNDOU um navio!" : marca == 'X' ? "ACERTOU um navio!" : "agua.");
+                    }
+                }
+            }
+            else if (strstr(command, "OPPONENT_FIRE")) {
                 int opp_x, opp_y;
                 char result_str[10];
                 if (sscanf(command, "OPPONENT_FIRE %d %d %s", &opp_x, &opp_y, result_str) == 3) {
@@ -246,16 +582,14 @@ int main(int argc, char const *argv[]) {
             }
             else if (strstr(command, CMD_WIN)) {
                 printf("\n--- FIM DE JOGO: VOCE VENCEU! ---\n");
-                imprimir_tabuleiro(meu_tab);
-                printf("\nTabuleiro adversario final:\n");
-                imprimir_tabuleiro(tab_adversario);
+                mostrar_tabuleiros(meu_tab, tab_adversario, "Tabuleiro adversario final");
+                teve_vencedor = 1;
                 goto end_game; // Usar goto para sair de loops aninhados de forma limpa
             }
             else if (strstr(command, CMD_LOSE)) {
                 printf("\n--- FIM DE JOGO: VOCE PERDEU! ---\n");
-                imprimir_tabuleiro(meu_tab);
-                printf("\nTabuleiro adversario final:\n");
-                imprimir_tabuleiro(tab_adversario);
+                mostrar_tabuleiros(meu_tab, tab_adversario, "Tabuleiro adversario final");
+                teve_vencedor = 1;
                 goto end_game;
             }
             else if (strstr(command, CMD_END)) {
@@ -263,18 +597,60 @@ int main(int argc, char const *argv[]) {
                 goto end_game;
             }
             else if (strstr(command, CMD_PLAY)) {
+                if (strstr(command, "Continua sendo sua vez")) printf("Servidor: %s\n", command); // Salva recusada
                 printf("\n--- SEU TURNO! --- \n");
-                printf("Seu tabuleiro:\n");
-                imprimir_tabuleiro(meu_tab);
-                printf("\nTabuleiro do Adversario (seus tiros):\n");
-                imprimir_tabuleiro(tab_adversario);
-                printf("Digite %s <Coordenada> (ex: A1):\n", CMD_FIRE);
+                mostrar_tabuleiros(meu_tab, tab_adversario, "Tabuleiro do Adversario (seus tiros)");
+                if (modo_salvo) {
+                    printf("Modo salvo: um tiro por navio seu ainda inteiro (ex: %s A1 B2 C3).\n", CMD_FIRE);
+                }
+                printf("Digite %s <Coordenada> (ex: A1) ou %s para ressincronizar os tabuleiros:\n", CMD_FIRE, CMD_STATE);
 
                 char fire_cmd_input[MAX_MSG];
                 while(1) {
                     fgets(fire_cmd_input, sizeof(fire_cmd_input), stdin);
                     fire_cmd_input[strcspn(fire_cmd_input, "\n")] = 0;
 
+                    // STATE nao gasta a vez: o servidor responde e continua esperando o FIRE
+                    if (strcmp(fire_cmd_input, CMD_STATE) == 0) {
+                        GameState st;
+                        int r = ressincronizar(sock, meu_tab, tab_adversario, &st);
+                        if (r < 0) {
+                            printf("Servidor desconectado durante a ressincronizacao.\n");
+                            goto end_game;
+                        }
+                        if (r == 0) mostrar_tabuleiros(meu_tab, tab_adversario, "Tabuleiro do Adversario (seus tiros)");
+                        printf("Digite %s <Coordenada> (ex: A1):\n", CMD_FIRE);
+                        continue;
+                    }
+
+                    // Modo salvo: todas as coordenadas seguem no mesmo FIRE (o servidor confere o limite)
+                    if (modo_salvo && strncmp(fire_cmd_input, CMD_FIRE, strlen(CMD_FIRE)) == 0) {
+                        char server_cmd[MAX_MSG];
+                        size_t len = (size_t)snprintf(server_cmd, sizeof(server_cmd), "%s", CMD_FIRE);
+                        const char *p = fire_cmd_input + strlen(CMD_FIRE);
+                        char linha_tiro;
+                        int coluna_tiro, usado, tiros = 0, valida = 1;
+                        while (valida && sscanf(p, " %c%d%n", &linha_tiro, &coluna_tiro, &usado) == 2) {
+                            p += usado;
+                            linha_tiro = toupper(linha_tiro);
+                            if (linha_tiro < 'A' || linha_tiro > ('A' + BOARD_SIZE - 1) || coluna_tiro < 1 || coluna_tiro > BOARD_SIZE ||
+                                tiros == MAX_SHIPS) {
+                                valida = 0;
+                                break;
+                            }
+                            len += (size_t)snprintf(server_cmd + len, sizeof(server_cmd) - len, " %d %d", linha_tiro - 'A', coluna_tiro - 1);
+                            tiros++;
+                        }
+                        if (!valida || tiros == 0) {
+                            printf("Salva invalida. Formato: %s A1 B2 ... (Letra A-%c e Numero 1-%d, ate %d tiros).\n",
+                                   CMD_FIRE, 'A' + BOARD_SIZE - 1, BOARD_SIZE, MAX_SHIPS);
+                            continue;
+                        }
+                        last_fire_x = -1; // Os resultados vem com as coordenadas (SALVO)
+                        send(sock, server_cmd, strlen(server_cmd), 0);
+                        break;
+                    }
+
                     char row_char_in;
                     int col_num_in;
                     if (sscanf(fire_cmd_input, CMD_FIRE " %c%d", &row_char_in, &col_num_in) == 2) {
@@ -323,7 +699,7 @@ int main(int argc, char const *argv[]) {
         }
 
         // AGORA, espera pela próxima mensagem do servidor para a próxima iteração do loop
-        n = recv(sock, buffer, sizeof(buffer)-1, 0);
+        n = receber(sock, buffer, sizeof(buffer)-1);
         if (n <= 0) {
             printf("Servidor desconectado. Fim de jogo.\n");
             break;
@@ -333,6 +709,44 @@ int main(int argc, char const *argv[]) {
 
 end_game:; // Rótulo para o goto
 
+    // Depois de uma partida com vencedor o servidor mantem a conexao: os dois jogadores podem
+    // pedir revanche e voltar ao posicionamento sem reconectar
+    if (teve_vencedor) {
+        char resposta[16] = "";
+        printf("Jogar revanche? (s/n): ");
+        if (fgets(resposta, sizeof(resposta), stdin) && (resposta[0] == 's' || resposta[0] == 'S')) {
+            send(sock, CMD_REMATCH, strlen(CMD_REMATCH), 0);
+            printf("Revanche pedida. Aguardando o adversario...\n");
+            int revanche = 0, recusada = 0;
+            while (!revanche && !recusada) {
+                n = receber(sock, buffer, sizeof(buffer)-1);
+                if (n <= 0) {
+                    printf("Servidor desconectado antes da revanche.\n");
+                    break;
+                }
+                buffer[n] = '\0';
+                // Ignora o END da partida anterior e o aviso de espera
+                for (char *linha = strtok(buffer, "\n"); linha; linha = strtok(NULL, "\n")) {
+                    if (strncmp(linha, CMD_REMATCH_ERRO, strlen(CMD_REMATCH_ERRO)) == 0) {
+                        printf("Servidor: %s\n", linha);
+                        recusada = 1;
+                        break;
+                    }
+                    if (strcmp(linha, CMD_REMATCH_OK) == 0) {
+                        revanche = 1;
+                        break;
+                    }
+                }
+            }
+            if (revanche) {
+                memset(meu_tab, ' ', sizeof(meu_tab));
+                memset(tab_adversario, ' ', sizeof(tab_adversario));
+                printf("\n--- REVANCHE! ---\n");
+                goto nova_partida;
+            }
+        }
+    }
+
     close(sock); // Fecha o socket ao final do jogo
     printf("Conexao com o servidor encerrada.\n");
     return 0;
@@ -7,18 +7,33 @@
 #define MAX_SHIPS 4  // Total de navios por jogador (1S + 2F + 1D = 4)
 
 // Comandos do cliente para o servidor
-#define CMD_JOIN "JOIN"
+#define CMD_JOIN "JOIN"     // JOIN <nome> [sala]: sem sala, entra na fila publica
 #define CMD_POS "POS"
 #define CMD_READY "READY"
-#define CMD_FIRE "FIRE"
+#define CMD_FIRE "FIRE"     // FIRE <X> <Y>; no modo salvo, FIRE <X> <Y> [<X> <Y> ...]
+#define CMD_TOP "TOP"       // TOP [n]: ranking dos n melhores jogadores
+#define CMD_RATING "RATING" // RATING [nome]: rating de um jogador (padrao: o proprio)
+#define CMD_STATE "STATE"   // STATE: estado autoritativo da partida (resposta STATE <hex>, ver state.h)
+#define CMD_REMATCH "REMATCH" // REMATCH: depois do END de uma partida com vencedor, revanche na mesma conexao
 
 // Comandos/mensagens do servidor para o cliente
 #define CMD_PLAY "PLAY" // Servidor envia para o jogador que deve jogar
 #define CMD_HIT "HIT"   // Acertou um navio
 #define CMD_MISS "MISS" // Errou o tiro
 #define CMD_SUNK "SUNK" // Afundou um navio
+#define CMD_SALVO "SALVO" // Resultado de uma salva: SALVO <X> <Y> <HIT|MISS|SUNK> ... (um trio por tiro)
+#define CMD_OPPONENT_SALVO "OPPONENT_SALVO" // Salva recebida, no mesmo formato (para o defensor)
 #define CMD_WIN "WIN"   // Vitoria (o jogador venceu)
 #define CMD_LOSE "LOSE" // Derrota (o jogador perdeu)
-#define CMD_END "END"   // Fim de jogo geral (servidor encerra)
+#define CMD_END "END"   // Fim da partida: depois de abandono o servidor encerra; depois de WIN/LOSE espera REMATCH ou o fechamento
+#define CMD_JOIN_OK "JOIN_OK"     // JOIN aceito: JOIN_OK <sala|publica> <1|2>
+#define CMD_JOIN_ERRO "JOIN_ERRO" // JOIN recusado (nome em uso, nome longo...): o cliente pode repetir
+#define CMD_RANK "RANK" // Linha do ranking: RANK <pos> <nome> <elo> <vitorias> <derrotas> <afundados>
+#define CMD_TOP_FIM "TOP_FIM" // Fim da resposta ao TOP
+#define CMD_REMATCH_OK "REMATCH_OK"     // Os dois pediram revanche: a partida volta ao posicionamento
+#define CMD_REMATCH_ERRO "REMATCH_ERRO" // Revanche impossivel (o adversario saiu): o servidor encerra a conexao
+
+#define TOP_DEFAULT 10 // Quantidade padrao de jogadores no TOP
+#define TOP_MAX 50     // Maximo de jogadores em uma resposta TOP
 
 #endif // PROTOCOL_H
\ No newline at end of file
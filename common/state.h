@@ -0,0 +1,115 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <string.h>
+
+#include "protocol.h"
+
+// Estado autoritativo de uma partida do ponto de vista de um jogador, enviado na resposta
+// ao comando STATE como "STATE <hex>". Empacotamento (casa i = x * BOARD_SIZE + y):
+//   byte 0: bits 0-1 fase (STATE_PHASE_*), bit 2 = vez deste jogador, bit 3 = pronto
+//   byte 1: bits 0-3 navios do adversario afundados, bits 4-7 navios proprios afundados
+//   tipos dos navios proprios: 2 bits por casa (0 = agua, 1 = S, 2 = F, 3 = D)
+//   4 mapas de 1 bit por casa: tiros recebidos que acertaram, que erraram,
+//   tiros dados que acertaram, que erraram
+// Com o tabuleiro 8x8 sao 50 bytes (100 caracteres hexadecimais).
+
+#define STATE_PHASE_PLACEMENT 0
+#define STATE_PHASE_PLAYING 1
+#define STATE_PHASE_OVER 2
+
+#define STATE_CELLS (BOARD_SIZE * BOARD_SIZE)
+#define STATE_BITMAP_BYTES ((STATE_CELLS + 7) / 8)
+#define STATE_TYPES_BYTES ((STATE_CELLS * 2 + 7) / 8)
+#define STATE_BYTES (2 + STATE_TYPES_BYTES + 4 * STATE_BITMAP_BYTES)
+#define STATE_HEX_LEN (STATE_BYTES * 2)
+
+typedef struct {
+    int phase;            // STATE_PHASE_*
+    int my_turn;          // 1 se e a vez deste jogador
+    int ready;            // 1 se este jogador ja enviou READY
+    int sunk_by_me;       // Navios do adversario afundados por este jogador
+    int sunk_by_opponent; // Navios deste jogador afundados pelo adversario
+    char own_ships[BOARD_SIZE][BOARD_SIZE]; // ' ', 'S', 'F' ou 'D'
+    char own_shots[BOARD_SIZE][BOARD_SIZE]; // Tiros recebidos: ' ', 'X' (acerto) ou 'O' (agua)
+    char opp_shots[BOARD_SIZE][BOARD_SIZE]; // Tiros dados: ' ', 'X' ou 'O'
+} GameState;
+
+static const char state_ship_symbols[4] = { ' ', 'S', 'F', 'D' };
+
+static inline void state_set_bit(unsigned char *bits, int i) {
+    bits[i >> 3] |= (unsigned char)(1u << (i & 7));
+}
+
+static inline int state_get_bit(const unsigned char *bits, int i) {
+    return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+static inline void state_pack(const GameState *st, unsigned char out[STATE_BYTES]) {
+    memset(out, 0, STATE_BYTES);
+    unsigned char *types = out + 2;
+    unsigned char *own_hit = types + STATE_TYPES_BYTES;
+    unsigned char *own_miss = own_hit + STATE_BITMAP_BYTES;
+    unsigned char *opp_hit = own_miss + STATE_BITMAP_BYTES;
+    unsigned char *opp_miss = opp_hit + STATE_BITMAP_BYTES;
+
+    out[0] = (unsigned char)((st->phase & 3) | (st->my_turn ? 4 : 0) | (st->ready ? 8 : 0));
+    out[1] = (unsigned char)((st->sunk_by_me & 0x0f) | (st->sunk_by_opponent & 0x0f) << 4);
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            int i = x * BOARD_SIZE + y;
+            const char *sym = memchr(state_ship_symbols + 1, st->own_ships[x][y], 3);
+            if (sym) types[i >> 2] |= (unsigned char)((sym - state_ship_symbols) << ((i & 3) * 2));
+            if (st->own_shots[x][y] == 'X') state_set_bit(own_hit, i);
+            if (st->own_shots[x][y] == 'O') state_set_bit(own_miss, i);
+            if (st->opp_shots[x][y] == 'X') state_set_bit(opp_hit, i);
+            if (st->opp_shots[x][y] == 'O') state_set_bit(opp_miss, i);
+        }
+    }
+}
+
+static inline void state_unpack(const unsigned char in[STATE_BYTES], GameState *st) {
+    const unsigned char *types = in + 2;
+    const unsigned char *own_hit = types + STATE_TYPES_BYTES;
+    const unsigned char *own_miss = own_hit + STATE_BITMAP_BYTES;
+    const unsigned char *opp_hit = own_miss + STATE_BITMAP_BYTES;
+    const unsigned char *opp_miss = opp_hit + STATE_BITMAP_BYTES;
+
+    st->phase = in[0] & 3;
+    st->my_turn = (in[0] >> 2) & 1;
+    st->ready = (in[0] >> 3) & 1;
+    st->sunk_by_me = in[1] & 0x0f;
+    st->sunk_by_opponent = in[1] >> 4;
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            int i = x * BOARD_SIZE + y;
+            st->own_ships[x][y] = state_ship_symbols[(types[i >> 2] >> ((i & 3) * 2)) & 3];
+            st->own_shots[x][y] = state_get_bit(own_hit, i) ? 'X' : state_get_bit(own_miss, i) ? 'O' : ' ';
+            st->opp_shots[x][y] = state_get_bit(opp_hit, i) ? 'X' : state_get_bit(opp_miss, i) ? 'O' : ' ';
+        }
+    }
+}
+
+// hex precisa de STATE_HEX_LEN + 1 bytes
+static inline void state_to_hex(const unsigned char bytes[STATE_BYTES], char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < STATE_BYTES; i++) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+    }
+    hex[STATE_HEX_LEN] = '\0';
+}
+
+// Retorna 0 se hex tem exatamente STATE_HEX_LEN digitos validos, -1 caso contrario
+static inline int state_from_hex(const char *hex, unsigned char bytes[STATE_BYTES]) {
+    for (int i = 0; i < STATE_HEX_LEN; i++) {
+        char c = hex[i];
+        int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+        if (v < 0) return -1;
+        if (i & 1) bytes[i / 2] |= (unsigned char)v;
+        else bytes[i / 2] = (unsigned char)(v << 4);
+    }
+    return (hex[STATE_HEX_LEN] == '\0' || hex[STATE_HEX_LEN] == '\n' || hex[STATE_HEX_LEN] == '\r') ? 0 : -1;
+}
+
+#endif // STATE_H
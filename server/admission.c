@@ -0,0 +1,73 @@
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "admission.h"
+
+// Balde de fichas de um IP. As fichas sao guardadas em milesimos para recarga inteira.
+typedef struct {
+    uint32_t ip;        // IP dono do balde (0 = livre)
+    uint32_t tokens;    // Fichas * 1000
+    uint64_t last_ms;   // Ultima recarga
+} IpBucket;
+
+static IpBucket buckets[ADMISSION_SLOTS];
+static unsigned admission_rate = ADMISSION_RATE_DEFAULT;
+static unsigned admission_burst = ADMISSION_BURST_DEFAULT;
+
+AdmissionStats admission_stats;
+
+void admission_configure(unsigned rate, unsigned burst) {
+    admission_rate = rate;
+    admission_burst = burst > 0 ? burst : 1;
+    if (admission_burst > ADMISSION_BURST_MAX) admission_burst = ADMISSION_BURST_MAX;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts); // Sem syscall real (vDSO)
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Recarrega o balde ate o instante now
+static void bucket_refill(IpBucket *b, uint64_t now, uint32_t full) {
+    if (now <= b->last_ms) return;
+    uint64_t refill = (now - b->last_ms) * admission_rate; // fichas * 1000
+    b->tokens = refill >= full - b->tokens ? full : b->tokens + (uint32_t)refill;
+    b->last_ms = now;
+}
+
+int admission_allow(uint32_t ip) {
+    if (admission_rate == 0) return 1;
+
+    // Hash multiplicativo na ordem do host, usando os bits altos do produto: os baixos so
+    // dependeriam do primeiro octeto e de parte do segundo, e IPs da mesma rede colidiriam
+    uint32_t h = (ntohl(ip) * 2654435761u) >> (32 - ADMISSION_SLOT_BITS);
+    IpBucket *set = &buckets[h & ~(uint32_t)(ADMISSION_WAYS - 1)];
+    uint64_t now = now_ms();
+    uint32_t full = admission_burst * 1000;
+
+    IpBucket *b = NULL;
+    IpBucket *victim = &set[0];
+    for (int w = 0; w < ADMISSION_WAYS && !b; w++) {
+        if (set[w].ip == ip) b = &set[w];
+        else if (victim->ip != 0 && (set[w].ip == 0 || set[w].last_ms < victim->last_ms)) victim = &set[w];
+    }
+    if (!b) {
+        b = victim;
+        if (b->ip == 0) {
+            b->tokens = full; // Balde livre: o IP comeca com a rajada completa
+        } else {
+            // Troca do menos recente: o novo IP herda as fichas que o antigo teria agora, nunca
+            // uma rajada nova. Sem isso, IPs que colidem e se alternam nunca seriam limitados.
+            bucket_refill(b, now, full);
+        }
+        b->ip = ip;
+        b->last_ms = now;
+    } else {
+        bucket_refill(b, now, full);
+    }
+
+    if (b->tokens < 1000) return 0;
+    b->tokens -= 1000;
+    return 1;
+}
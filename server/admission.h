@@ -0,0 +1,35 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+// Controle de admissao de conexoes novas (executado apenas pela thread de accept).
+// Cada IP de origem tem um balde de fichas: cada conexao gasta uma ficha e as fichas
+// voltam a uma taxa fixa. Um host abusivo esgota o proprio balde e passa a ser recusado
+// sem criar thread nem enviar nada, sem afetar os demais.
+
+#define LISTEN_BACKLOG_DEFAULT 1024 // Fila de conexoes pendentes do listen()
+#define ACCEPT_BATCH 64             // Maximo de conexoes aceitas por despertar
+#define ADMISSION_RATE_DEFAULT 10   // Conexoes por segundo por IP
+#define ADMISSION_BURST_DEFAULT 20  // Rajada maxima por IP
+#define ADMISSION_SLOT_BITS 13      // log2 de ADMISSION_SLOTS
+#define ADMISSION_SLOTS (1u << ADMISSION_SLOT_BITS) // Baldes na tabela
+#define ADMISSION_WAYS 4            // Baldes por conjunto (associativa por conjunto, troca o menos recente)
+#define ADMISSION_BURST_MAX 1000000 // Rajada * 1000 precisa caber nas fichas de 32 bits
+
+typedef struct {
+    unsigned long accepted;
+    unsigned long rejected_rate;  // Recusadas pelo limite por IP
+    unsigned long rejected_full;  // Recusadas por lotacao ("Jogo cheio")
+} AdmissionStats;
+
+// rate = 0 desativa o limite por IP
+void admission_configure(unsigned rate, unsigned burst);
+
+// Retorna 1 se uma conexao do IP (ordem de rede) pode ser admitida agora
+int admission_allow(uint32_t ip);
+
+// Contadores (so a thread de accept escreve)
+extern AdmissionStats admission_stats;
+
+#endif // ADMISSION_H
@@ -1,67 +1,68 @@
+#define _GNU_SOURCE // POLLRDHUP
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <sys/select.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
 
 #include "../common/protocol.h"
-
-#define MAX_PLAYERS 2
-
-// Estrutura para representar um jogador
-typedef struct {
-    int id;
+#include "../common/state.h"
+#include "io_backend.h"
+#include "ratings.h"
+#include "results.h"
+#include "lobby.h"
+#include "admission.h"
+#include "trace.h"
+#include "handoff.h"
+#include "coro.h"
+#include "match.h"
+
+#define MAX_CLIENTS_DEFAULT 4096  // Conexoes simultaneas aceitas (somando todas as partidas)
+#define HANDOFF_PARK_POLL_MS 10   // Intervalo entre rodadas de interrupcoes ate todas as sessoes pararem
+#define HANDOFF_OUT_DRAIN_MS 2000 // Prazo para as saidas pendentes (clientes lentos) antes da troca de processo
+
+struct Session;
+
+// Conexao atendida por uma corrotina. Todas ficam em uma lista global para que a troca de
+// processo (--handoff) possa parar cada sessao em um ponto seguro e transferir o socket.
+typedef struct Session {
+    Coro *coro;
     int socket;
-    char name[50];
-    char board[BOARD_SIZE][BOARD_SIZE]; // Tabuleiro do jogador
-    int ships_sunk; // Quantidade de navios afundados do adversário para este jogador
-    int ready; // 0 = nao pronto, 1 = pronto
-    pthread_mutex_t lock; // Mutex para proteger o acesso aos dados do jogador
-    int pos_submarino; // Contadores de navios posicionados
-    int pos_fragata;
-    int pos_destroyer;
-    // Array para registrar os navios para facilitar a verificação de afundamento
-    // Formato: {x_origem, y_origem, orientacao_char_as_int, comprimento, hits_recebidos, tipo_char_as_int}
-    int ships[MAX_SHIPS][6];
-    int num_ships_placed; // Quantidade de navios efetivamente posicionados (para o array ships)
-} Player;
-
-// Tipos de navio e seus comprimentos
-typedef struct {
-    char symbol;
-    int length;
-    const char* name;
-    int max_count; // Quantidade máxima desse tipo de navio por jogador
-} ShipType;
-
-ShipType ship_types[] = {
-    {'S', 1, "SUBMARINO", 1},
-    {'F', 2, "FRAGATA", 2},
-    {'D', 3, "DESTROYER", 1}
-};
-#define NUM_SHIP_TYPES (sizeof(ship_types) / sizeof(ShipType))
+    int resumed;    // 1 se a conexao veio de outro processo (boas-vindas ja enviadas)
+    int phase;      // HANDOFF_PHASE_*: onde a sessao esta e onde retoma no processo novo
+    int parked;     // 1 enquanto a sessao estiver parada para a troca de processo
+    Player *player; // NULL antes do JOIN
+    size_t carry_len;
+    char carry[MAX_MSG]; // Bytes ja lidos do socket e ainda nao processados (troca de processo)
+    struct Session *prev;
+    struct Session *next;
+} Session;
 
 // Variáveis globais do servidor
-Player players[MAX_PLAYERS];
-int num_connected_players = 0;
-// =================== INÍCIO: REGIÃO DE PARALELISMO ===================
-// Declaração do mutex global para proteger o array de jogadores e variáveis globais
-pthread_mutex_t players_mutex = PTHREAD_MUTEX_INITIALIZER;
-// Condição para sincronizar quando ambos os jogadores estão prontos
-pthread_cond_t all_players_ready_cond = PTHREAD_COND_INITIALIZER;
-// Condição para sincronizar a vez de cada jogador
-pthread_cond_t turn_cond = PTHREAD_COND_INITIALIZER; // Para sincronizar os turnos
-// =================== FIM: REGIÃO DE PARALELISMO ===================
-int current_player_turn = -1; // -1 = nenhum, 0 = player 0, 1 = player 1
-int game_started = 0; // Flag para indicar se o jogo começou
-int game_over = 0; // Flag para indicar se o jogo terminou
+int connected_clients = 0; // Conexoes ativas, em todas as partidas (acesso atomico)
+int max_clients = MAX_CLIENTS_DEFAULT;
+int salvo_mode = 0; // --salvo: um FIRE leva ate um tiro por navio do atacante ainda inteiro
+
+static Session *sessions = NULL;
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sessions_cond = PTHREAD_COND_INITIALIZER; // Sessao parou ou saiu (espera da troca)
+static CoroCond sessions_resume = CORO_COND_INITIALIZER;         // Troca cancelada: sessoes paradas voltam
+static int draining = 0;         // 1 durante a troca de processo: sessoes param no proximo ponto seguro
+static int takeover_pending = 0; // 1 enquanto este processo ainda recebe as partidas do anterior
+static pthread_mutex_t takeover_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CoroCond takeover_cond = CORO_COND_INITIALIZER;
 
 // --- Funções Auxiliares de Validação ---
 
 // Encontra o ShipType dado o símbolo ou nome
-ShipType* get_ship_type_info(const char* identifier) {
+const ShipType* get_ship_type_info(const char* identifier) {
     for (int i = 0; i < NUM_SHIP_TYPES; i++) {
         if (strcmp(identifier, ship_types[i].name) == 0 ||
             (strlen(identifier) == 1 && identifier[0] == ship_types[i].symbol)) {
@@ -71,27 +72,20 @@ ShipType* get_ship_type_info(const char* identifier) {
     return NULL;
 }
 
+// Relogio de parede em milissegundos (inicio e fim das partidas em --results)
+static uint64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
 // Envia uma mensagem para o socket do jogador, adicionando uma nova linha
 void send_to_player(int player_socket, const char* message) {
-    char full_message[MAX_MSG];
+    if (player_socket <= 0) return; // Jogador ja saiu da partida
+    char full_message[MAX_MSG + 1]; // Mensagem de ate MAX_MSG - 1 caracteres, \n e o nulo
     // Garante que a mensagem termine com \n e seja nula terminada
     snprintf(full_message, sizeof(full_message), "%s\n", message);
-    send(player_socket, full_message, strlen(full_message), 0);
-}
-
-// Inicializa o tabuleiro e os contadores de navios de um jogador
-void init_player_state(Player *player) {
-    for (int i = 0; i < BOARD_SIZE; i++) {
-        for (int j = 0; j < BOARD_SIZE; j++) {
-            player->board[i][j] = ' ';
-        }
-    }
-    player->pos_submarino = 0;
-    player->pos_fragata = 0;
-    player->pos_destroyer = 0;
-    player->num_ships_placed = 0; // Resetar contagem de navios no array
-    player->ships_sunk = 0; // Resetar navios afundados
-    player->ready = 0; // Garantir que o jogador não esteja pronto por padrão
+    io_send(player_socket, full_message, strlen(full_message)); // Pode ser acumulada em um lote (io_uring)
 }
 
 // Verifica se o navio está dentro dos limites do tabuleiro
@@ -137,8 +131,8 @@ int is_overlapping(Player *player, int x, int y, char orientation, int ship_len)
              return 1; // Considerar como sobreposição se o cálculo for ruim
         }
 
-        if (player->board[current_x][current_y] != ' ') {
-            printf("DEBUG: is_overlapping: Sobreposicao detectada em (%d,%d) com navio '%c'.\n", current_x, current_y, player->board[current_x][current_y]);
+        if (player->ships & cell_bit(current_x, current_y)) {
+            printf("DEBUG: is_overlapping: Sobreposicao detectada em (%d,%d) com navio '%c'.\n", current_x, current_y, player_cell(player, current_x, current_y));
             return 1; // Sobreposição
         }
     }
@@ -158,39 +152,36 @@ void handle_pos_command(Player *player, char* command) {
         return;
     }
 
-    ShipType* ship_info = get_ship_type_info(tipo_navio_str);
+    const ShipType* ship_info = get_ship_type_info(tipo_navio_str);
     if (!ship_info) {
         send_to_player(player->socket, "Tipo de navio invalido.");
         printf("DEBUG: Jogador %s enviou tipo de navio '%s' nao encontrado.\n", player->name, tipo_navio_str);
         return;
     }
 
-    pthread_mutex_lock(&player->lock); // Proteger o estado do jogador durante o posicionamento
+    int type = (int)(ship_info - ship_types);
+    board_lock(&player->lock); // Proteger o estado do jogador durante o posicionamento
 
     // Verifica a contagem de navios para o tipo ANTES de qualquer outra validação
-    int *count_ptr = NULL;
-    if (ship_info->symbol == 'S') count_ptr = &player->pos_submarino;
-    else if (ship_info->symbol == 'F') count_ptr = &player->pos_fragata;
-    else if (ship_info->symbol == 'D') count_ptr = &player->pos_destroyer;
-
-    if (count_ptr == NULL || *count_ptr >= ship_info->max_count) {
+    int count = player_count_ships(player, type);
+    if (count >= ship_info->max_count) {
         char msg[MAX_MSG];
-        snprintf(msg, sizeof(msg), "Limite de navios do tipo %s atingido (%d/%d).", ship_info->name, *count_ptr, ship_info->max_count);
+        snprintf(msg, sizeof(msg), "Limite de navios do tipo %s atingido (%d/%d).", ship_info->name, count, ship_info->max_count);
         send_to_player(player->socket, msg);
-        printf("DEBUG: Jogador %s: Limite de %s atingido ou tipo nao mapeado para contagem: %d/%d\n", player->name, ship_info->name, *count_ptr, ship_info->max_count);
-        pthread_mutex_unlock(&player->lock);
+        printf("DEBUG: Jogador %s: Limite de %s atingido: %d/%d\n", player->name, ship_info->name, count, ship_info->max_count);
+        board_unlock(&player->lock);
         return;
     }
 
     // Validações de posicionamento no tabuleiro
     if (!is_valid_position(player, x, y, o, ship_info->length)) {
         send_to_player(player->socket, "Posicionamento invalido: Fora dos limites do tabuleiro.");
-        pthread_mutex_unlock(&player->lock);
+        board_unlock(&player->lock);
         return;
     }
     if (is_overlapping(player, x, y, o, ship_info->length)) {
         send_to_player(player->socket, "Posicionamento invalido: Sobreposicao com outro navio.");
-        pthread_mutex_unlock(&player->lock);
+        board_unlock(&player->lock);
         return;
     }
     
@@ -198,81 +189,157 @@ void handle_pos_command(Player *player, char* command) {
     if (player->num_ships_placed >= MAX_SHIPS) {
         send_to_player(player->socket, "Erro interno: Capacidade maxima de navios no array atingida.");
         printf("DEBUG: Jogador %s: Tentou posicionar mais de MAX_SHIPS navios no array.\n", player->name);
-        pthread_mutex_unlock(&player->lock);
+        board_unlock(&player->lock);
         return;
     }
 
-    // Se tudo ok, posiciona o navio no tabuleiro
-    for (int i = 0; i < ship_info->length; i++) {
-        if (o == 'H' || o == 'h') {
-            player->board[x][y + i] = ship_info->symbol;
-        } else { // 'V' ou 'v'
-            player->board[x + i][y] = ship_info->symbol;
-        }
-    }
-
-    // Atualiza os contadores de navios por tipo
-    (*count_ptr)++;
-    
-    // Armazena as informações do navio no array para checar afundamento depois
-    // Indices: {0:x, 1:y, 2:orientation_as_int, 3:length, 4:hits_received, 5:symbol_as_int}
-    player->ships[player->num_ships_placed][0] = x;
-    player->ships[player->num_ships_placed][1] = y;
-    player->ships[player->num_ships_placed][2] = (int)o; // Armazena char como int
-    player->ships[player->num_ships_placed][3] = ship_info->length;
-    player->ships[player->num_ships_placed][4] = 0; // Hits recebidos (inicialmente 0)
-    player->ships[player->num_ships_placed][5] = (int)ship_info->symbol; // Armazena char como int
+    // Se tudo ok, registra o navio (origem, tipo e orientacao) e marca as casas no tabuleiro
+    ShipDesc *ship = &player->fleet[player->num_ships_placed];
+    ship->origin = (uint8_t)(x * BOARD_SIZE + y);
+    ship->type = (uint8_t)type;
+    ship->vertical = (o == 'V' || o == 'v');
+    ship->hits = 0; // Hits recebidos (inicialmente 0)
+    player->ships |= ship_cells(*ship);
 
     player->num_ships_placed++; // Incrementa o contador de navios posicionados no array
 
     send_to_player(player->socket, "Navio posicionado com sucesso.");
-    pthread_mutex_unlock(&player->lock);
     printf("DEBUG: Jogador %s posicionou %s em (%d,%d) %c. Contagem: S:%d, F:%d, D:%d. Total navios registrados no array: %d\n",
-           player->name, ship_info->name, x, y, o, player->pos_submarino, player->pos_fragata, player->pos_destroyer, player->num_ships_placed);
+           player->name, ship_info->name, x, y, o, player_count_ships(player, 0), player_count_ships(player, 1),
+           player_count_ships(player, 2), player->num_ships_placed);
+    board_unlock(&player->lock);
 }
 
 // Lida com o comando READY
 void handle_ready_command(Player *player) {
+    Match *match = player_match(player);
     // Verifica se todos os navios foram posicionados: 1 SUBMARINO, 2 FRAGATAS, 1 DESTROYER
-    if (player->pos_submarino == 1 && player->pos_fragata == 2 && player->pos_destroyer == 1) {
-        pthread_mutex_lock(&players_mutex);
+    int placed[NUM_SHIP_TYPES];
+    board_lock(&player->lock);
+    for (int i = 0; i < NUM_SHIP_TYPES; i++) placed[i] = player_count_ships(player, i);
+    board_unlock(&player->lock);
+    if (placed[0] == 1 && placed[1] == 2 && placed[2] == 1) {
+        pthread_mutex_lock(&match->mutex);
         player->ready = 1;
         send_to_player(player->socket, "READY recebido. Aguardando adversario...");
         printf("DEBUG: Jogador %s esta pronto.\n", player->name);
 
         // Verifica se ambos os jogadores estão prontos para iniciar o jogo
-        if (players[0].ready && players[1].ready && !game_started) {
-            game_started = 1;
+        if (match->players[0].ready && match->players[1].ready && !match->game_started) {
+            match->game_started = 1;
+            match->cold.started_ms = wall_clock_ms();
             // Define o jogador 0 como o primeiro a jogar (pode ser randomizado no futuro)
-            current_player_turn = 0;
-            printf("DEBUG: Ambos os jogadores estao prontos. Jogo iniciando! Turno do jogador %s.\n", players[current_player_turn].name);
-            pthread_cond_broadcast(&all_players_ready_cond); // Notifica as threads para iniciar o jogo
+            match->current_player_turn = 0;
+            printf("DEBUG: Ambos os jogadores estao prontos. Jogo iniciando! Turno do jogador %s.\n", match->players[match->current_player_turn].name);
+            coro_cond_broadcast(&match->all_players_ready_cond); // Notifica as threads para iniciar o jogo
         }
-        pthread_mutex_unlock(&players_mutex);
+        pthread_mutex_unlock(&match->mutex);
     } else {
         char msg[MAX_MSG];
         snprintf(msg, sizeof(msg), "Erro: Voce ainda nao posicionou todos os navios (1 Submarino, 2 Fragatas, 1 Destroyer).");
         send_to_player(player->socket, msg);
         printf("DEBUG: Jogador %s tentou READY mas nao posicionou todos os navios: S:%d, F:%d, D:%d\n",
-               player->name, player->pos_submarino, player->pos_fragata, player->pos_destroyer);
+               player->name, placed[0], placed[1], placed[2]);
+    }
+}
+
+// Vitoria do atacante (com o lock do defensor): WIN/LOSE. O ranking fica para end_turn.
+static void announce_win(Player *attacker, Player *defender) {
+    Match *match = player_match(attacker);
+    send_to_player(attacker->socket, CMD_WIN);
+    send_to_player(defender->socket, CMD_LOSE);
+    printf("DEBUG: Jogo terminou. Jogador %s venceu.\n", attacker->name);
+    printf("DEBUG: Backend %s: %lu syscalls de I/O ate agora, %d turnos nesta partida.\n",
+           io_backend_name(io_backend), io_syscall_count(), match->turn_count);
+}
+
+// Linha de --results da partida que este atacante acabou de vencer. O defensor esta esperando
+// a vez, entao ninguem mais mexe nos tabuleiros; tiros e acertos saem dos mapas de bits.
+static void record_result(Player *winner) {
+    Match *match = player_match(winner);
+    ResultsRow row;
+    memset(&row, 0, sizeof(row));
+    row.end_ms = wall_clock_ms();
+    if (match->cold.started_ms && row.end_ms > match->cold.started_ms) {
+        row.duration_ms = (uint32_t)(row.end_ms - match->cold.started_ms);
     }
+    row.turns = match->turn_count;
+    row.winner = winner->id;
+    row.flags = salvo_mode ? RESULTS_FLAG_SALVO : 0;
+    for (int i = 0; i < PLAYERS_PER_MATCH; i++) {
+        const Player *target = &match->players[1 - i];
+        row.shots[i] = (uint16_t)__builtin_popcountll(target->hits | target->misses);
+        row.hits[i] = (uint16_t)__builtin_popcountll(target->hits);
+        snprintf(row.names[i], sizeof(row.names[i]), "%s", match->players[i].name ? match->players[i].name : "");
+    }
+    int sunk = match->players[0].ships_sunk + match->players[1].ships_sunk;
+    for (int k = 0; k < RESULTS_SUNK_MAX; k++) {
+        row.sunk_order[k] = (k < sunk && k < (int)sizeof(match->cold.sunk_order)) ? match->cold.sunk_order[k] : RESULTS_SUNK_NONE;
+    }
+    results_record(&row);
+}
+
+// Fim de um turno com tiros resolvidos: passa a vez ao defensor ou, com vitoria, encerra a
+// partida. Depois envia o lote de mensagens do turno.
+static void end_turn(Player *attacker, Player *defender, int game_won, int turn) {
+    Match *match = player_match(attacker);
+
+    // Fim de jogo: WIN/LOSE precisam sair antes de game_over ficar visivel. Senao a thread
+    // do perdedor, que le game_over ao voltar ao inicio do loop, pode encerrar e mandar END
+    // antes do LOSE (com io_uring o LOSE ainda estaria no lote)
+    if (game_won) {
+        io_batch_flush();
+        // Fora do lock do tabuleiro e antes de game_over ficar visivel ao perdedor. Os dois so
+        // enfileiram: a gravacao em disco fica com threads de fundo.
+        ratings_record_result(attacker->name, defender->name, attacker->ships_sunk, defender->ships_sunk);
+        if (results_enabled()) record_result(attacker);
+    }
+
+    // Troca o turno, se o jogo não terminou
+    uint64_t t_stage = trace_now();
+    pthread_mutex_lock(&match->mutex); // =================== INÍCIO: REGIÃO CRÍTICA GLOBAL ===================
+    if (game_won) match->game_over = MATCH_OVER_WON;
+    if (!match->game_over) {
+        match->current_player_turn = (int8_t)defender->id;
+        send_to_player(attacker->socket, "AGUARDE");
+        send_to_player(defender->socket, CMD_PLAY);
+        match->turn_count++;
+        printf("DEBUG: Turno trocado para Jogador %s.\n", match->players[match->current_player_turn].name);
+        match->cold.handoff_ns = trace_now(); // O adversario mede o proprio despertar a partir daqui
+        // =================== INÍCIO: SINCRONIZAÇÃO ENTRE THREADS (troca de turno) ===================
+        coro_cond_broadcast(&match->turn_cond); // Notifica as threads que o turno mudou
+        // =================== FIM: SINCRONIZAÇÃO ENTRE THREADS ===================
+    } else {
+        // Fim de jogo: acorda o defensor, que esta esperando a vez, para que ele encerre
+        coro_cond_broadcast(&match->turn_cond);
+    }
+    pthread_mutex_unlock(&match->mutex); // =================== FIM: REGIÃO CRÍTICA GLOBAL ===================
+    trace_span("troca_turno", t_stage, turn);
+
+    // Com o backend io_uring as mensagens acima so saem aqui: o envio real e medido a parte
+    t_stage = trace_now();
+    io_batch_flush(); // Submete as mensagens acumuladas do turno
+    trace_span("envio_lote", t_stage, turn);
 }
 
 // Lida com o comando FIRE (ataque)
 void handle_fire_command(Player *attacker, char* command) {
-    if (!game_started || game_over) {
+    Match *match = player_match(attacker);
+    if (!match->game_started || match->game_over) {
         send_to_player(attacker->socket, "O jogo nao comecou ou ja terminou.");
         return;
     }
 
     int target_player_id = (attacker->id == 0) ? 1 : 0;
-    Player *defender = &players[target_player_id];
+    Player *defender = &match->players[target_player_id];
 
-    if (attacker->id != current_player_turn) {
+    if (attacker->id != match->current_player_turn) {
         send_to_player(attacker->socket, "Nao e sua vez de jogar.");
         return;
     }
 
+    int turn = match->turn_count; // So o jogador da vez altera o contador
+    uint64_t t_stage = trace_now();
     int x, y;
     if (sscanf(command, CMD_FIRE " %d %d", &x, &y) != 2) {
         send_to_player(attacker->socket, "Comando FIRE invalido. Formato: FIRE <X> <Y>");
@@ -283,75 +350,72 @@ void handle_fire_command(Player *attacker, char* command) {
         send_to_player(attacker->socket, "Coordenadas de tiro invalidas (0-7).");
         return;
     }
+    trace_span("parse", t_stage, turn);
     
+    // As mensagens do turno (resultado, notificacao, troca de vez) seguem em um unico lote
+    io_batch_begin();
+
     // =================== INÍCIO: REGIÃO CRÍTICA INDIVIDUAL (defensor) ===================
-    pthread_mutex_lock(&defender->lock); // Proteger o tabuleiro do defensor
+    t_stage = trace_now();
+    board_lock(&defender->lock); // Proteger o tabuleiro do defensor
+    trace_span("lock_defensor", t_stage, turn);
+    t_stage = trace_now();
 
     // Evita atirar na mesma posição já atingida (X) ou errada (O)
-    if (defender->board[x][y] == 'X' || defender->board[x][y] == 'O') {
+    uint64_t target = cell_bit(x, y);
+    if ((defender->hits | defender->misses) & target) {
         send_to_player(attacker->socket, "Voce ja atirou nesta posicao. Tente outra.");
-        pthread_mutex_unlock(&defender->lock);
+        board_unlock(&defender->lock);
+        trace_span("tabuleiro", t_stage, turn);
         // Troca o turno mesmo em caso de tiro repetido
-        pthread_mutex_lock(&players_mutex);
-        if (!game_over) {
-            current_player_turn = target_player_id;
+        t_stage = trace_now();
+        pthread_mutex_lock(&match->mutex);
+        if (!match->game_over) {
+            match->current_player_turn = target_player_id;
             send_to_player(attacker->socket, "AGUARDE");
             send_to_player(defender->socket, CMD_PLAY);
-            pthread_cond_broadcast(&turn_cond);
+            match->turn_count++;
+            match->cold.handoff_ns = trace_now();
+            coro_cond_broadcast(&match->turn_cond);
         }
-        pthread_mutex_unlock(&players_mutex);
+        pthread_mutex_unlock(&match->mutex);
+        trace_span("troca_turno", t_stage, turn);
+        t_stage = trace_now();
+        io_batch_flush();
+        trace_span("envio", t_stage, turn);
         return;
     }
 
-    char target_cell = defender->board[x][y];
+    int game_won = 0;
     char msg_to_attacker[MAX_MSG];
     char msg_to_defender[MAX_MSG];
 
-    if (target_cell != ' ') { // Acertou um navio (S, F ou D)
-        defender->board[x][y] = 'X'; // Marca como atingido no tabuleiro do defensor
+    if (defender->ships & target) { // Acertou um navio (S, F ou D)
+        defender->hits |= target; // Marca como atingido no tabuleiro do defensor
         snprintf(msg_to_attacker, sizeof(msg_to_attacker), "%s", CMD_HIT);
 
         // Encontrar o navio atingido e incrementar hits
-        int ship_hit_index = -1;
-        for(int i = 0; i < defender->num_ships_placed; i++) {
-            // Recupere as informações do navio do array
-            int ship_x = defender->ships[i][0];
-            int ship_y = defender->ships[i][1];
-            char ship_o = (char)defender->ships[i][2]; // Converte de int para char
-            int ship_len = defender->ships[i][3];
-
-            if (ship_o == 'H' || ship_o == 'h') {
-                if (x == ship_x && y >= ship_y && y < ship_y + ship_len) {
-                    ship_hit_index = i;
-                    break;
-                }
-            } else { // Vertical
-                if (y == ship_y && x >= ship_x && x < ship_x + ship_len) {
-                    ship_hit_index = i;
-                    break;
-                }
-            }
-        }
-
+        int ship_hit_index = player_ship_at(defender, x, y);
         if (ship_hit_index != -1) {
-            defender->ships[ship_hit_index][4]++; // Incrementa hits (índice 4 é 'hits_recebidos')
+            ShipDesc *ship = &defender->fleet[ship_hit_index];
+            const ShipType *info = &ship_types[ship->type];
+            ship->hits++;
             printf("DEBUG: Navio '%c' de %s em (%d,%d) recebeu %d/%d hits.\n",
-                   (char)defender->ships[ship_hit_index][5], defender->name, defender->ships[ship_hit_index][0], defender->ships[ship_hit_index][1], // Usamos o symbol_char aqui
-                   defender->ships[ship_hit_index][4], defender->ships[ship_hit_index][3]); // Hits e Length
+                   info->symbol, defender->name, ship->origin / BOARD_SIZE, ship->origin % BOARD_SIZE,
+                   ship->hits, info->length);
 
-            if (defender->ships[ship_hit_index][4] == defender->ships[ship_hit_index][3]) {
+            if (ship->hits == info->length) {
                 // Navio afundado
                 snprintf(msg_to_attacker, sizeof(msg_to_attacker), "%s", CMD_SUNK);
                 attacker->ships_sunk++; // Atacante afundou um navio
+                match_note_sunk(attacker, ship);
 
                 printf("DEBUG: Jogador %s afundou um navio do jogador %s. Total afundados por %s: %d.\n",
                        attacker->name, defender->name, attacker->name, attacker->ships_sunk);
 
                 if (attacker->ships_sunk == MAX_SHIPS) { // Todos os 4 navios do adversário afundados
-                    game_over = 1; // Fim de jogo
-                    send_to_player(attacker->socket, CMD_WIN);
-                    send_to_player(defender->socket, CMD_LOSE);
-                    printf("DEBUG: Jogo terminou. Jogador %s venceu.\n", attacker->name);
+                    game_won = 1; // Fim de jogo (game_over so e marcado depois dos envios, abaixo)
+                    announce_win(attacker, defender);
                 }
             }
         }
@@ -359,269 +423,1445 @@ void handle_fire_command(Player *attacker, char* command) {
         snprintf(msg_to_defender, sizeof(msg_to_defender), "OPPONENT_FIRE %d %d %s", x, y, (strcmp(msg_to_attacker, CMD_SUNK) == 0) ? CMD_SUNK : CMD_HIT);
 
     } else { // Errou o tiro
-        defender->board[x][y] = 'O'; // Marca como erro no tabuleiro do defensor
+        defender->misses |= target; // Marca como erro no tabuleiro do defensor
         snprintf(msg_to_attacker, sizeof(msg_to_attacker), "%s", CMD_MISS);
         snprintf(msg_to_defender, sizeof(msg_to_defender), "OPPONENT_FIRE %d %d %s", x, y, CMD_MISS);
     }
+    trace_span("tabuleiro", t_stage, turn);
 
+    t_stage = trace_now();
     send_to_player(attacker->socket, msg_to_attacker); // Resposta ao atacante
     send_to_player(defender->socket, msg_to_defender); // Notificação ao defensor
 
-    pthread_mutex_unlock(&defender->lock); // Liberar o lock do tabuleiro do defensor
+    board_unlock(&defender->lock); // Liberar o lock do tabuleiro do defensor
     // =================== FIM: REGIÃO CRÍTICA INDIVIDUAL ===================
+    trace_span("envio", t_stage, turn);
 
-    // Troca o turno, se o jogo não terminou
-    pthread_mutex_lock(&players_mutex); // =================== INÍCIO: REGIÃO CRÍTICA GLOBAL ===================
-    if (!game_over) {
-        current_player_turn = target_player_id;
-        send_to_player(attacker->socket, "AGUARDE");
-        send_to_player(defender->socket, CMD_PLAY);
-        printf("DEBUG: Turno trocado para Jogador %s.\n", players[current_player_turn].name);
-        // =================== INÍCIO: SINCRONIZAÇÃO ENTRE THREADS (troca de turno) ===================
-        pthread_cond_broadcast(&turn_cond); // Notifica as threads que o turno mudou
-        // =================== FIM: SINCRONIZAÇÃO ENTRE THREADS ===================
+    end_turn(attacker, defender, game_won, turn);
+}
+
+// Salva recusada: a vez continua com o atacante, e o PLAY no fim da linha avisa o cliente
+static void reject_salvo(Player *attacker, const char *reason) {
+    char msg[MAX_MSG];
+    snprintf(msg, sizeof(msg), "%s Continua sendo sua vez. %s", reason, CMD_PLAY);
+    send_to_player(attacker->socket, msg);
+}
+
+// Lida com o comando FIRE no modo salvo: FIRE <X> <Y> [<X> <Y> ...], com ate um tiro por navio
+// do atacante ainda inteiro. A salva inteira e resolvida com uma unica aquisicao do lock do
+// defensor e cada lado recebe uma mensagem so com todos os resultados (SALVO para o atacante,
+// OPPONENT_SALVO para o defensor), em vez de uma ida e volta e dois envios por tiro. Uma salva
+// invalida (formato, casa fora do tabuleiro, casa repetida ou ja atingida) e recusada inteira
+// e nao gasta a vez.
+void handle_salvo_command(Player *attacker, char* command) {
+    Match *match = player_match(attacker);
+    if (!match->game_started || match->game_over) {
+        send_to_player(attacker->socket, "O jogo nao comecou ou ja terminou.");
+        return;
     }
-    pthread_mutex_unlock(&players_mutex); // =================== FIM: REGIÃO CRÍTICA GLOBAL ===================
+
+    Player *defender = &match->players[(attacker->id == 0) ? 1 : 0];
+
+    if (attacker->id != match->current_player_turn) {
+        send_to_player(attacker->socket, "Nao e sua vez de jogar.");
+        return;
+    }
+
+    int turn = match->turn_count; // So o jogador da vez altera o contador
+    uint64_t t_stage = trace_now();
+    int allowed = MAX_SHIPS - defender->ships_sunk; // Navios do atacante que seguem inteiros
+    int xs[MAX_SHIPS], ys[MAX_SHIPS];
+    int shots = 0, x, y, used;
+    uint64_t targets = 0;
+    char msg[MAX_MSG];
+    const char *p = command + strlen(CMD_FIRE);
+
+    while (sscanf(p, " %d %d%n", &x, &y, &used) == 2) {
+        p += used;
+        if (shots == allowed) {
+            snprintf(msg, sizeof(msg), "Salva grande demais: voce tem direito a %d tiro(s) nesta vez.", allowed);
+            reject_salvo(attacker, msg);
+            return;
+        }
+        if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE) {
+            reject_salvo(attacker, "Coordenadas de tiro invalidas (0-7).");
+            return;
+        }
+        if (targets & cell_bit(x, y)) {
+            reject_salvo(attacker, "A salva repete uma casa.");
+            return;
+        }
+        targets |= cell_bit(x, y);
+        xs[shots] = x;
+        ys[shots] = y;
+        shots++;
+    }
+    p += strspn(p, " \t\r");
+    if (shots == 0 || *p != '\0') {
+        snprintf(msg, sizeof(msg), "Comando FIRE invalido. Formato: FIRE <X> <Y> [<X> <Y> ...], ate %d tiro(s).", allowed);
+        reject_salvo(attacker, msg);
+        return;
+    }
+    trace_span("parse", t_stage, turn);
+
+    // Os resultados, a troca de vez e um eventual fim de jogo seguem em um unico lote
+    io_batch_begin();
+
+    // =================== INÍCIO: REGIÃO CRÍTICA INDIVIDUAL (defensor) ===================
+    t_stage = trace_now();
+    board_lock(&defender->lock); // Uma aquisicao para a salva inteira
+    trace_span("lock_defensor", t_stage, turn);
+    t_stage = trace_now();
+
+    if ((defender->hits | defender->misses) & targets) {
+        board_unlock(&defender->lock);
+        reject_salvo(attacker, "A salva inclui uma casa em que voce ja atirou.");
+        io_batch_flush();
+        return;
+    }
+
+    char msg_to_attacker[MAX_MSG] = CMD_SALVO;
+    char msg_to_defender[MAX_MSG] = CMD_OPPONENT_SALVO;
+    size_t len_attacker = strlen(msg_to_attacker), len_defender = strlen(msg_to_defender);
+    for (int i = 0; i < shots; i++) {
+        uint64_t target = cell_bit(xs[i], ys[i]);
+        const char *result = CMD_MISS;
+        if (defender->ships & target) { // Acertou um navio (S, F ou D)
+            defender->hits |= target;
+            result = CMD_HIT;
+            int ship_hit_index = player_ship_at(defender, xs[i], ys[i]);
+            if (ship_hit_index != -1) {
+                ShipDesc *ship = &defender->fleet[ship_hit_index];
+                ship->hits++;
+                if (ship->hits == ship_types[ship->type].length) {
+                    result = CMD_SUNK;
+                    attacker->ships_sunk++; // Atacante afundou um navio
+                    match_note_sunk(attacker, ship);
+                }
+            }
+        } else { // Errou o tiro
+            defender->misses |= target;
+        }
+        len_attacker += snprintf(msg_to_attacker + len_attacker, sizeof(msg_to_attacker) - len_attacker, " %d %d %s", xs[i], ys[i], result);
+        len_defender += snprintf(msg_to_defender + len_defender, sizeof(msg_to_defender) - len_defender, " %d %d %s", xs[i], ys[i], result);
+    }
+    int game_won = (attacker->ships_sunk == MAX_SHIPS);
+    trace_span("tabuleiro", t_stage, turn);
+
+    t_stage = trace_now();
+    send_to_player(attacker->socket, msg_to_attacker); // Resultado da salva ao atacante
+    send_to_player(defender->socket, msg_to_defender); // Notificação ao defensor
+    printf("DEBUG: Jogador %s disparou %d tiro(s) contra %s:%s\n", attacker->name, shots, defender->name,
+           msg_to_attacker + strlen(CMD_SALVO));
+    if (game_won) announce_win(attacker, defender);
+
+    board_unlock(&defender->lock); // Liberar o lock do tabuleiro do defensor
+    // =================== FIM: REGIÃO CRÍTICA INDIVIDUAL ===================
+    trace_span("envio", t_stage, turn);
+
+    end_turn(attacker, defender, game_won, turn);
 }
 
-// Thread para lidar com a comunicação de cada cliente
-void *handle_client(void *arg) {
-    Player *player = (Player *)arg;
-    char buffer[MAX_MSG];
-    ssize_t n;
+// Lida com o comando TOP (ranking persistente)
+void handle_top_command(Player *player, char* command) {
+    int n = TOP_DEFAULT;
+    sscanf(command, CMD_TOP " %d", &n);
+    if (n < 1) n = 1;
+    if (n > TOP_MAX) n = TOP_MAX;
 
-    printf("DEBUG: Thread do cliente %s (ID: %d) iniciada.\n", player->name, player->id);
+    if (!ratings_enabled()) {
+        send_to_player(player->socket, "Ranking desativado neste servidor.");
+        send_to_player(player->socket, CMD_TOP_FIM);
+        return;
+    }
 
-    // Envia a mensagem inicial ANTES de esperar pelo JOIN para evitar deadlock.
-    pthread_mutex_lock(&players_mutex);
-    if (num_connected_players == 1) { // Este é o primeiro jogador a se conectar (0-indexed)
-         send_to_player(player->socket, "Aguardando outro jogador...");
-    } else if (num_connected_players == 2) { // Este é o segundo jogador
-        send_to_player(player->socket, "Conectado. Preparando para o jogo.");
-    }
-    pthread_mutex_unlock(&players_mutex);
-
-    // Agora, espera pelo comando JOIN do cliente
-    n = recv(player->socket, buffer, sizeof(buffer) - 1, 0);
-    if (n <= 0) {
-        printf("DEBUG: Cliente %s desconectou antes de enviar JOIN.\n", player->name);
-        close(player->socket);
-        pthread_exit(NULL);
-    }
-    buffer[n] = '\0';
-    buffer[strcspn(buffer, "\n")] = 0;
-
-    if (strncmp(buffer, CMD_JOIN, strlen(CMD_JOIN)) == 0) {
-        sscanf(buffer, CMD_JOIN " %s", player->name);
-        printf("DEBUG: Jogador %s (ID: %d) se juntou ao jogo.\n", player->name, player->id);
+    RatingRecord top[TOP_MAX];
+    int count = ratings_top(top, n);
+    char msg[MAX_MSG];
+    for (int i = 0; i < count; i++) {
+        snprintf(msg, sizeof(msg), "%s %d %.*s %d %u %u %u", CMD_RANK, i + 1, (int)sizeof(top[i].name), top[i].name, top[i].elo,
+                 top[i].wins, top[i].losses, top[i].ships_sunk);
+        send_to_player(player->socket, msg);
+    }
+    send_to_player(player->socket, CMD_TOP_FIM);
+}
+
+// Lida com o comando RATING (consulta o rating de um jogador)
+void handle_rating_command(Player *player, char* command) {
+    char name[RATING_NAME_LEN];
+    if (sscanf(command, CMD_RATING " %49s", name) != 1) {
+        snprintf(name, sizeof(name), "%s", player->name);
+    }
+
+    RatingRecord rec;
+    char msg[MAX_MSG];
+    if (ratings_lookup(name, &rec) == 0) {
+        snprintf(msg, sizeof(msg), "%s %s %d %u %u %u", CMD_RATING, rec.name, rec.elo, rec.wins, rec.losses, rec.ships_sunk);
     } else {
-        send_to_player(player->socket, "Comando invalido. Use JOIN <seu_nome>.");
-        close(player->socket);
-        pthread_exit(NULL);
+        snprintf(msg, sizeof(msg), "%s %s sem partidas registradas", CMD_RATING, name);
+    }
+    send_to_player(player->socket, msg);
+}
+
+// Lida com o comando STATE: envia o estado autoritativo da partida para o cliente se
+// ressincronizar (tabuleiro proprio, tiros dados e recebidos, afundados e vez), empacotado
+// em bits (ver common/state.h). Cada parte e lida sob o lock que a protege, uma de cada vez.
+void handle_state_command(Player *player) {
+    Match *match = player_match(player);
+    Player *opponent = &match->players[(player->id == 0) ? 1 : 0];
+    GameState st;
+
+    pthread_mutex_lock(&match->mutex);
+    st.phase = match->game_over ? STATE_PHASE_OVER : match->game_started ? STATE_PHASE_PLAYING : STATE_PHASE_PLACEMENT;
+    st.my_turn = match->game_started && match->current_player_turn == player->id;
+    st.ready = player->ready;
+    pthread_mutex_unlock(&match->mutex);
+
+    board_lock(&player->lock);
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            int ship = player_ship_at(player, x, y);
+            uint64_t bit = cell_bit(x, y);
+            st.own_ships[x][y] = ship < 0 ? ' ' : ship_types[player->fleet[ship].type].symbol;
+            st.own_shots[x][y] = (player->hits & bit) ? 'X' : (player->misses & bit) ? 'O' : ' ';
+        }
+    }
+    st.sunk_by_me = player->ships_sunk;
+    board_unlock(&player->lock);
+
+    board_lock(&opponent->lock);
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            uint64_t bit = cell_bit(x, y);
+            st.opp_shots[x][y] = (opponent->hits & bit) ? 'X' : (opponent->misses & bit) ? 'O' : ' ';
+        }
+    }
+    st.sunk_by_opponent = opponent->ships_sunk;
+    board_unlock(&opponent->lock);
+
+    unsigned char packed[STATE_BYTES];
+    char msg[MAX_MSG];
+    state_pack(&st, packed);
+    memcpy(msg, CMD_STATE " ", strlen(CMD_STATE) + 1);
+    state_to_hex(packed, msg + strlen(CMD_STATE) + 1);
+    send_to_player(player->socket, msg);
+}
+
+// --- Partidas ---
+
+// Verifica, sem consumir dados, se o cliente fechou a conexao. POLLRDHUP reflete o estado
+// do socket mesmo com um recv multishot do io_uring pendente, entao vale para os dois backends.
+static int peer_hung_up(int fd) {
+    if (fd <= 0) return 0;
+    struct pollfd pfd = { .fd = fd, .events = POLLRDHUP };
+    io_count_syscall();
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR));
+}
+
+#define WAIT_HUNG_UP 1     // wait_checking_hangup: o cliente desconectou
+#define WAIT_CLIENT_DATA 2 // wait_checking_hangup: acordou por dados do cliente (ou interrupcao)
+
+// Espera na condicao (com o mutex da partida travado). Retorna WAIT_HUNG_UP se o cliente deste
+// jogador desconectou: quem so espera nao le o socket e, sem essa verificacao, ficaria preso
+// para sempre se o adversario nunca aparecesse. A espera tambem acorda com eventos do socket
+// (dados ou FIN), e so entao confere se foi desconexao. Um FIN que chegou junto com o ultimo
+// comando ja teve o evento consumido pelo recv, por isso a conferencia antes de esperar.
+static int wait_checking_hangup(Player *player, CoroCond *cond) {
+    if (peer_hung_up(player->socket)) return WAIT_HUNG_UP;
+    if (!coro_cond_wait(cond, &player_match(player)->mutex, 1)) return 0;
+    return peer_hung_up(player->socket) ? WAIT_HUNG_UP : WAIT_CLIENT_DATA;
+}
+
+// Responde os STATE que chegaram enquanto o jogador esperava o adversario (pronto ou vez), para
+// um cliente dessincronizado nao precisar esperar a sua vez. Qualquer outro comando fica no
+// socket para o recv da fase seguinte. Chamada sem o mutex da partida.
+static void serve_state_while_waiting(Player *player, IoConn *conn) {
+    char buffer[MAX_MSG];
+    while (1) {
+        ssize_t n = io_peek(conn, buffer, sizeof(buffer) - 1);
+        if (n < (ssize_t)strlen(CMD_STATE)) return; // Nada, fechamento ou comando ainda incompleto
+        buffer[n] = '\0';
+        if (strncmp(buffer, CMD_STATE, strlen(CMD_STATE)) != 0) return;
+        // Consome so a linha do STATE: o que o cliente mandou depois dela no mesmo segmento
+        // (ex: "STATE\nFIRE 1 2") continua la para o proximo recv
+        char *end = strchr(buffer, '\n');
+        size_t line = end ? (size_t)(end - buffer) + 1 : (size_t)n;
+        if (io_recv(conn, buffer, line) <= 0) return;
+        handle_state_command(player);
+    }
+}
+
+// Encerra a partida porque este jogador saiu: avisa o adversario e o acorda onde quer que ele
+// esteja (recv, espera por pronto ou pela vez). Retorna 1 se foi esta chamada que encerrou a
+// partida, 0 se ela ja tinha terminado.
+int abandon_match(Player *player, const char *notice) {
+    Match *match = player_match(player);
+    Player *other = &match->players[(player->id == 0) ? 1 : 0];
+    int ended_here = 0;
+
+    pthread_mutex_lock(&match->mutex);
+    if (!match->game_over) { // Garante que a lógica de fim de jogo execute apenas uma vez
+        ended_here = 1;
+        if (other->socket != 0) {
+            send_to_player(other->socket, notice); // Antes de game_over: o aviso chega antes do END
+            io_count_syscall();
+            shutdown(other->socket, SHUT_RD); // Um recv bloqueado do adversario retorna 0
+        }
+        match->game_over = MATCH_OVER_ABANDONED;
+        coro_cond_broadcast(&match->all_players_ready_cond);
+        coro_cond_broadcast(&match->turn_cond);
+    }
+    pthread_mutex_unlock(&match->mutex);
+    return ended_here;
+}
+
+// --- Sessoes e troca de processo ---
+
+void *handle_client(void *arg);
+
+// Registra a sessao e cria a corrotina que a atende. O lock cobre o coro_spawn para que a
+// corrotina nao saia (e libere a sessao) antes de session->coro ser preenchido.
+int session_start(Session *session) {
+    pthread_mutex_lock(&sessions_mutex);
+    session->prev = NULL;
+    session->next = sessions;
+    if (sessions) sessions->prev = session;
+    sessions = session;
+    // =================== INÍCIO: REGIÃO DE PARALELISMO ===================
+    // Cria uma corrotina para cada cliente conectado. Cada uma executa a função handle_client.
+    session->coro = coro_spawn(handle_client, session);
+    // =================== FIM: REGIÃO DE PARALELISMO ===================
+    if (!session->coro) {
+        if (session->next) session->next->prev = NULL;
+        sessions = session->next;
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+    return session->coro ? 0 : -1;
+}
+
+// Tira a sessao atual da lista (a corrotina esta saindo)
+static void session_finish(void) {
+    Session *session = coro_local(CORO_LOCAL_SESSION);
+    if (!session) return;
+    pthread_mutex_lock(&sessions_mutex);
+    if (session->prev) session->prev->next = session->next;
+    else sessions = session->next;
+    if (session->next) session->next->prev = session->prev;
+    if (draining) pthread_cond_broadcast(&sessions_cond); // A troca de processo espera quem esta saindo
+    pthread_mutex_unlock(&sessions_mutex);
+    free(session);
+    coro_set_local(CORO_LOCAL_SESSION, NULL);
+}
+
+// Para a sessao para a troca de processo: o estado de I/O e desfeito (sem mexer no socket) e a
+// corrotina espera o processo terminar. So retorna se a troca for cancelada, com a conexao
+// reaberta neste processo.
+static void session_park(IoConn *conn) {
+    Session *session = coro_local(CORO_LOCAL_SESSION);
+    session->carry_len = io_conn_detach(conn, session->carry, sizeof(session->carry));
+
+    pthread_mutex_lock(&sessions_mutex);
+    session->parked = 1;
+    pthread_cond_broadcast(&sessions_cond);
+    while (draining) coro_cond_wait(&sessions_resume, &sessions_mutex, 0);
+    session->parked = 0;
+    pthread_mutex_unlock(&sessions_mutex);
+
+    io_conn_open(conn, session->socket);
+    io_conn_preload(conn, session->carry, session->carry_len);
+    io_set_thread_conn(conn);
+}
+
+// Le um comando do cliente. Durante uma troca de processo a sessao para antes de esperar
+// (ou quando a interrupcao encerra a espera) e, se a troca for cancelada, volta a esperar.
+static ssize_t client_recv(IoConn *conn, char *buffer, size_t len) {
+    while (1) {
+        if (__atomic_load_n(&draining, __ATOMIC_ACQUIRE)) session_park(conn);
+        ssize_t n = io_recv(conn, buffer, len);
+        if (n != IO_RECV_INTERRUPTED) return n;
+    }
+}
+
+// Ponto seguro dentro das esperas por pronto e pela vez (com o mutex da partida travado)
+static void park_if_draining(Match *match, IoConn *conn) {
+    if (!__atomic_load_n(&draining, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_unlock(&match->mutex);
+    session_park(conn);
+    pthread_mutex_lock(&match->mutex);
+}
+
+// Processo novo: o JOIN espera as partidas herdadas entrarem no lobby (nomes e salas abertas)
+static void wait_takeover(void) {
+    if (!__atomic_load_n(&takeover_pending, __ATOMIC_ACQUIRE)) return;
+    pthread_mutex_lock(&takeover_mutex);
+    while (takeover_pending) coro_cond_wait(&takeover_cond, &takeover_mutex, 0);
+    pthread_mutex_unlock(&takeover_mutex);
+}
+
+// Encerra a participacao do jogador: libera o nome, envia a mensagem final (se houver),
+// encerra a conexao e solta a partida. O nome e liberado antes da mensagem final para que
+// o cliente possa reconectar com o mesmo nome assim que a receber.
+void leave_match(Player *player, IoConn *conn, const char *farewell) {
+    Match *match = player_match(player);
+
+    lobby_release_name(player->name);
+    if (farewell && player->socket != 0) send_to_player(player->socket, farewell);
+
+    io_conn_close(conn);
+    pthread_mutex_lock(&match->mutex);
+    int sock = player->socket;
+    player->socket = 0; // O adversario deixa de enviar para este jogador
+    match->cold.retired_sockets[player->id] = sock;
+    pthread_mutex_unlock(&match->mutex);
+    // O cliente recebe o FIN agora, mas o descritor so e fechado com a partida: o adversario
+    // pode ter um envio em lote pendente para ele, e o numero nao pode ir para outra conexao
+    if (sock != 0) {
+        io_count_syscall();
+        io_count_syscall(); // O close, feito depois por match_destroy
+        shutdown(sock, SHUT_RDWR);
+        io_out_forget(sock); // Quem parou de ler perde o que ainda estava na fila
+    }
+
+    // Partida que ainda estava aberta no lobby: ninguem mais pode entrar nela
+    if (lobby_withdraw(match->cold.room, match)) match_release(match);
+    match_release(match);
+    __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+    trace_thread_exit();
+    session_finish();
+}
+
+// Lida com o comando JOIN <nome> [sala]: valida o nome, registra-o no indice de nomes
+// online e emparelha o jogador pela sala (privada) ou pela fila publica.
+// Retorna o jogador na partida, ou NULL se o JOIN foi recusado (o cliente pode tentar de novo).
+Player *handle_join_command(int client_socket, char *command) {
+    char raw_name[MAX_MSG];
+    char raw_room[MAX_MSG] = "";
+    char name[NAME_MAX_LEN];
+    char room[ROOM_NAME_LEN];
+    char msg[MAX_MSG];
+
+    wait_takeover();
+    if (sscanf(command, CMD_JOIN " %255s %255s", raw_name, raw_room) < 1) {
+        send_to_player(client_socket, CMD_JOIN_ERRO " Formato: JOIN <nome> [sala]");
+        return NULL;
+    }
+    if (strlen(raw_name) >= NAME_MAX_LEN) {
+        snprintf(msg, sizeof(msg), "%s Nome muito longo (maximo %d caracteres).", CMD_JOIN_ERRO, NAME_MAX_LEN - 1);
+        send_to_player(client_socket, msg);
+        return NULL;
+    }
+    if (strlen(raw_room) >= ROOM_NAME_LEN) {
+        snprintf(msg, sizeof(msg), "%s Codigo de sala muito longo (maximo %d caracteres).", CMD_JOIN_ERRO, ROOM_NAME_LEN - 1);
+        send_to_player(client_socket, msg);
+        return NULL;
+    }
+    memcpy(name, raw_name, strlen(raw_name) + 1);
+    memcpy(room, raw_room, strlen(raw_room) + 1);
+    int registered = lobby_register_name(name);
+    if (registered == LOBBY_NO_MEMORY) {
+        send_to_player(client_socket, CMD_JOIN_ERRO " Servidor sem memoria para novas partidas.");
+        printf("DEBUG: JOIN recusado: sem memoria para registrar o nome %s.\n", name);
+        return NULL;
+    }
+    if (registered < 0) {
+        send_to_player(client_socket, CMD_JOIN_ERRO " Nome ja esta em uso. Escolha outro.");
+        printf("DEBUG: JOIN recusado: nome %s ja esta online.\n", name);
+        return NULL;
+    }
+    // Referencia ao nome internado durante o emparelhamento: com ela, player_set_name so
+    // incrementa a contagem e nao pode falhar no meio do caminho
+    const char *held_name = lobby_intern(name);
+
+    while (held_name) {
+        // Prepara uma partida com este jogador na primeira posicao, caso ele precise esperar
+        Match *fresh = match_create(room);
+        if (!fresh) break;
+        Player *player = &fresh->players[0];
+        player_set_name(player, held_name);
+        player->socket = client_socket;
+        fresh->num_players = 1;
+        fresh->refs = 2; // Este jogador + a entrada aberta no lobby
+
+        Match *match = room[0] ? lobby_take_or_open_room(room, fresh) : lobby_take_or_queue_public(fresh);
+        if (!match) {
+            match_destroy(fresh);
+            break;
+        }
+        if (match == fresh) {
+            snprintf(msg, sizeof(msg), "%s %s 1. Aguardando outro jogador...", CMD_JOIN_OK, room[0] ? room : "publica");
+            send_to_player(client_socket, msg);
+            printf("DEBUG: Jogador %s abriu a partida %s.\n", name, room[0] ? room : "publica");
+            lobby_unintern(held_name);
+            return player;
+        }
+        match_destroy(fresh); // Havia uma partida esperando: entra nela como segundo jogador
+
+        pthread_mutex_lock(&match->mutex);
+        if (match->game_over) {
+            // O criador saiu enquanto a partida era retirada do lobby: procura outra
+            pthread_mutex_unlock(&match->mutex);
+            match_release(match);
+            continue;
+        }
+        player = &match->players[1];
+        player_set_name(player, held_name);
+        player->socket = client_socket;
+        match->num_players = 2; // A referencia do lobby passa a ser deste jogador
+        pthread_mutex_unlock(&match->mutex);
+
+        snprintf(msg, sizeof(msg), "%s %s 2. Conectado. Preparando para o jogo.", CMD_JOIN_OK, room[0] ? room : "publica");
+        send_to_player(client_socket, msg);
+        printf("DEBUG: Jogador %s entrou na partida %s contra %s.\n", name, room[0] ? room : "publica", match->players[0].name);
+        lobby_unintern(held_name);
+        return player;
+    }
+
+    lobby_unintern(held_name);
+    lobby_release_name(name);
+    send_to_player(client_socket, CMD_JOIN_ERRO " Servidor sem memoria para novas partidas.");
+    return NULL;
+}
+
+// Este jogador saiu depois do fim sem revanche: o adversario, que pode estar decidindo ou
+// esperando a resposta, recebe REMATCH_ERRO e tem a conexao encerrada (so o primeiro avisa)
+static void cancel_rematch(Player *player) {
+    Match *match = player_match(player);
+    Player *other = &match->players[(player->id == 0) ? 1 : 0];
+
+    pthread_mutex_lock(&match->mutex);
+    if (!(match->rematch & REMATCH_CANCELLED)) {
+        match->rematch |= REMATCH_CANCELLED;
+        if (other->socket != 0) {
+            send_to_player(other->socket, CMD_REMATCH_ERRO " O adversario saiu. Jogo encerrado.");
+            io_count_syscall();
+            shutdown(other->socket, SHUT_RD); // Um recv bloqueado do adversario retorna 0
+        }
+        coro_cond_broadcast(&match->all_players_ready_cond);
+    }
+    pthread_mutex_unlock(&match->mutex);
+}
+
+// Fase depois do END de uma partida com vencedor. Com REMATCH dos dois jogadores, quem pediu
+// por ultimo recoloca a partida no posicionamento e avisa ambos com REMATCH_OK. Retorna 1 se a
+// revanche comecou ou 0 se a sessao foi encerrada (desconexao ou adversario que saiu).
+static int await_rematch(Player *player, IoConn *conn) {
+    Match *match = player_match(player);
+    Player *other = &match->players[(player->id == 0) ? 1 : 0];
+    uint8_t mine = (uint8_t)(1u << player->id);
+    uint8_t both = (1u << 0) | (1u << 1);
+    char buffer[MAX_MSG];
+
+    while (1) {
+        pthread_mutex_lock(&match->mutex);
+        // A revanche ja comecou (REMATCH_OK enviado por quem a iniciou)
+        if (!match->game_over) {
+            pthread_mutex_unlock(&match->mutex);
+            return 1;
+        }
+        int cancelled = (match->rematch & REMATCH_CANCELLED) || other->socket == 0;
+        if (!cancelled && (match->rematch & mine)) {
+            // =================== INÍCIO: SINCRONIZAÇÃO ENTRE THREADS (revanche) ===================
+            while (match->game_over && !(match->rematch & REMATCH_CANCELLED) && other->socket != 0) {
+                if (wait_checking_hangup(player, &match->all_players_ready_cond) == WAIT_HUNG_UP) {
+                    pthread_mutex_unlock(&match->mutex);
+                    printf("DEBUG: Cliente %s desconectou enquanto aguardava a revanche.\n", player->name);
+                    cancel_rematch(player);
+                    leave_match(player, conn, NULL);
+                    return 0;
+                }
+                park_if_draining(match, conn);
+            }
+            // =================== FIM: SINCRONIZAÇÃO ENTRE THREADS ===================
+            pthread_mutex_unlock(&match->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&match->mutex);
+        if (cancelled) {
+            leave_match(player, conn, NULL); // REMATCH_ERRO ja enviado por quem saiu
+            return 0;
+        }
+
+        ssize_t n = client_recv(conn, buffer, sizeof(buffer) - 1);
+        if (n <= 0) {
+            printf("DEBUG: Cliente %s saiu depois do fim da partida.\n", player->name);
+            cancel_rematch(player);
+            leave_match(player, conn, NULL);
+            return 0;
+        }
+        buffer[n] = '\0';
+        buffer[strcspn(buffer, "\n")] = 0;
+
+        if (strncmp(buffer, CMD_REMATCH, strlen(CMD_REMATCH)) == 0) {
+            pthread_mutex_lock(&match->mutex);
+            if (match->game_over && !(match->rematch & REMATCH_CANCELLED) && other->socket != 0) {
+                match->rematch |= mine;
+                if ((match->rematch & both) == both) {
+                    match_reset(match);
+                    send_to_player(player->socket, CMD_REMATCH_OK);
+                    send_to_player(other->socket, CMD_REMATCH_OK);
+                    printf("DEBUG: Revanche entre %s e %s.\n", match->players[0].name, match->players[1].name);
+                    coro_cond_broadcast(&match->all_players_ready_cond);
+                } else {
+                    send_to_player(player->socket, "REMATCH recebido. Aguardando adversario...");
+                }
+            }
+            pthread_mutex_unlock(&match->mutex);
+        } else if (strncmp(buffer, CMD_TOP, strlen(CMD_TOP)) == 0) {
+            handle_top_command(player, buffer);
+        } else if (strncmp(buffer, CMD_RATING, strlen(CMD_RATING)) == 0) {
+            handle_rating_command(player, buffer);
+        } else if (strncmp(buffer, CMD_STATE, strlen(CMD_STATE)) == 0) {
+            handle_state_command(player);
+        } else {
+            send_to_player(player->socket, "Partida encerrada. Use REMATCH para jogar de novo ou feche a conexao.");
+        }
     }
+}
+
+// Uma partida, do posicionamento ao fim. Retorna 1 quando a partida terminou com este jogador
+// ainda na sessao (o END fica com quem chama) ou 0 se a sessao ja foi encerrada aqui.
+static int play_match(Session *session, Player *player, IoConn *conn) {
+    Match *match = player_match(player);
+    char buffer[MAX_MSG];
+    ssize_t n;
 
     // Fase de posicionamento
-    while (!player->ready && !game_over) { // Adicionado !game_over para sair em caso de desconexão do outro
-        n = recv(player->socket, buffer, sizeof(buffer)-1, 0);
+    while (!player->ready && !match->game_over) { // Adicionado !game_over para sair em caso de desconexão do outro
+        uint64_t t_recv = trace_now();
+        n = client_recv(conn, buffer, sizeof(buffer)-1);
         if (n <= 0) {
-            printf("DEBUG: Cliente %s desconectou durante o posicionamento.\n", player->name);
-            game_over = 1; // Sinaliza o fim do jogo globalmente
-            // Tentar notificar o outro jogador sobre a desconexão
-            int other_player_id = (player->id == 0) ? 1 : 0;
-            if (players[other_player_id].socket != 0) { // Se o outro jogador ainda está conectado
-                 send_to_player(players[other_player_id].socket, "O adversario desconectou durante o posicionamento. Jogo encerrado.");
+            // Sinaliza o fim da partida e acorda o outro jogador, onde quer que ele esteja
+            if (abandon_match(player, "O adversario desconectou durante o posicionamento. Jogo encerrado.")) {
+                printf("DEBUG: Cliente %s desconectou durante o posicionamento.\n", player->name);
+                leave_match(player, conn, NULL);
+            } else {
+                leave_match(player, conn, CMD_END); // Partida encerrada pelo adversario
             }
-            pthread_mutex_lock(&players_mutex); // Lock para manipular flags de pronto
-            players[0].ready = 0; // Garante que o outro jogador nao espere infinitamente
-            players[1].ready = 0;
-            pthread_mutex_unlock(&players_mutex);
-            pthread_cond_broadcast(&all_players_ready_cond); // Notifica as threads para sair do wait
-            close(player->socket);
-            pthread_exit(NULL);
+            return 0;
         }
+        trace_span("recv", t_recv, 0);
         buffer[n] = '\0';
         buffer[strcspn(buffer, "\n")] = 0; // Remove a nova linha
 
+        uint64_t t_cmd = trace_now();
         if (strncmp(buffer, CMD_POS, strlen(CMD_POS)) == 0) {
             handle_pos_command(player, buffer);
+            trace_span(CMD_POS, t_cmd, 0);
         } else if (strncmp(buffer, CMD_READY, strlen(CMD_READY)) == 0) {
             handle_ready_command(player);
+            trace_span(CMD_READY, t_cmd, 0);
+        } else if (strncmp(buffer, CMD_TOP, strlen(CMD_TOP)) == 0) {
+            handle_top_command(player, buffer);
+            trace_span(CMD_TOP, t_cmd, 0);
+        } else if (strncmp(buffer, CMD_RATING, strlen(CMD_RATING)) == 0) {
+            handle_rating_command(player, buffer);
+            trace_span(CMD_RATING, t_cmd, 0);
+        } else if (strncmp(buffer, CMD_STATE, strlen(CMD_STATE)) == 0) {
+            handle_state_command(player);
+            trace_span(CMD_STATE, t_cmd, 0);
         } else {
             send_to_player(player->socket, "Comando invalido na fase de posicionamento. Use POS <TIPO> <X> <Y> <O> ou READY.");
             printf("DEBUG: Jogador %s enviou comando invalido na fase de pos: '%s'\n", player->name, buffer);
         }
     }
 
-    // Se o jogo acabou por desconexão durante o posicionamento, esta thread termina
-    if (game_over) {
-        close(player->socket);
-        pthread_exit(NULL);
+    // Se o jogo acabou por desconexão durante o posicionamento, esta sessao termina
+    if (match->game_over) {
+        leave_match(player, conn, CMD_END);
+        return 0;
     }
+    if (session->phase < HANDOFF_PHASE_WAIT_READY) session->phase = HANDOFF_PHASE_WAIT_READY;
 
     // Esperar que o outro jogador também esteja pronto
-    pthread_mutex_lock(&players_mutex);
-    while (!game_started) {
+    pthread_mutex_lock(&match->mutex);
+    while (!match->game_started) {
          // =================== INÍCIO: SINCRONIZAÇÃO ENTRE THREADS (ambos prontos) ===================
-        pthread_cond_wait(&all_players_ready_cond, &players_mutex);
+        int woke = wait_checking_hangup(player, &match->all_players_ready_cond);
         // =================== FIM: SINCRONIZAÇÃO ENTRE THREADS ===================
         // Verifica novamente se o jogo terminou enquanto esperava (ex: outro jogador desconectou)
-        if (game_over) {
-            pthread_mutex_unlock(&players_mutex);
-            close(player->socket);
-            pthread_exit(NULL);
+        if (match->game_over) {
+            pthread_mutex_unlock(&match->mutex);
+            leave_match(player, conn, CMD_END);
+            return 0;
+        }
+        if (woke == WAIT_HUNG_UP) {
+            pthread_mutex_unlock(&match->mutex);
+            printf("DEBUG: Cliente %s desconectou enquanto aguardava o adversario.\n", player->name);
+            abandon_match(player, "O adversario desconectou. Jogo encerrado.");
+            leave_match(player, conn, NULL);
+            return 0;
         }
+        if (woke == WAIT_CLIENT_DATA) {
+            pthread_mutex_unlock(&match->mutex);
+            serve_state_while_waiting(player, conn);
+            pthread_mutex_lock(&match->mutex);
+        }
+        park_if_draining(match, conn);
     }
-    pthread_mutex_unlock(&players_mutex);
+    pthread_mutex_unlock(&match->mutex);
 
     // Envia a mensagem de inicio de jogo e quem começa
-    // Isso é feito apenas uma vez por jogador
+    // Isso é feito apenas uma vez por jogador (inclusive entre processos, na troca)
     // Combina as mensagens para evitar problemas de recepção no cliente
-    if (player->id == current_player_turn) {
-        send_to_player(player->socket, "INICIO DO JOGO. E sua vez! PLAY");
-    } else {
-        send_to_player(player->socket, "INICIO DO JOGO. Aguarde a vez do adversario. AGUARDE");
+    if (session->phase < HANDOFF_PHASE_PLAYING) {
+        // No modo salvo o aviso vai junto: o cliente ajusta o FIRE sem precisar de outra mensagem
+        const char *rules = salvo_mode ? " Modo salvo: um tiro por navio seu ainda inteiro." : "";
+        char start_msg[MAX_MSG];
+        if (player->id == match->current_player_turn) {
+            snprintf(start_msg, sizeof(start_msg), "INICIO DO JOGO.%s E sua vez! PLAY", rules);
+        } else {
+            snprintf(start_msg, sizeof(start_msg), "INICIO DO JOGO.%s Aguarde a vez do adversario. AGUARDE", rules);
+        }
+        send_to_player(player->socket, start_msg);
+        session->phase = HANDOFF_PHASE_PLAYING;
     }
 
     // --- Fase de Jogo Principal ---
-    while (!game_over) {
-        pthread_mutex_lock(&players_mutex); // =================== INÍCIO: REGIÃO CRÍTICA GLOBAL ===================
+    while (!match->game_over) {
+        pthread_mutex_lock(&match->mutex); // =================== INÍCIO: REGIÃO CRÍTICA GLOBAL ===================
         // =================== INÍCIO: SINCRONIZAÇÃO ENTRE THREADS (turno) ===================
-        while (current_player_turn != player->id && !game_over) {
-            pthread_cond_wait(&turn_cond, &players_mutex);
+        int waited = 0;
+        while (match->current_player_turn != player->id && !match->game_over) {
+            waited = 1;
+            int woke = wait_checking_hangup(player, &match->turn_cond);
+            if (woke == WAIT_HUNG_UP) {
+                pthread_mutex_unlock(&match->mutex);
+                printf("DEBUG: Cliente %s desconectou enquanto aguardava a vez.\n", player->name);
+                abandon_match(player, "O adversario desconectou. Jogo encerrado.");
+                leave_match(player, conn, NULL);
+                return 0;
+            }
+            if (woke == WAIT_CLIENT_DATA) {
+                pthread_mutex_unlock(&match->mutex);
+                serve_state_while_waiting(player, conn);
+                pthread_mutex_lock(&match->mutex);
+            }
+            park_if_draining(match, conn);
         }
         // =================== FIM: SINCRONIZAÇÃO ENTRE THREADS ===================
-        if (game_over) {
-            pthread_mutex_unlock(&players_mutex); // =================== FIM: REGIÃO CRÍTICA GLOBAL ===================
+        if (match->game_over) {
+            pthread_mutex_unlock(&match->mutex); // =================== FIM: REGIÃO CRÍTICA GLOBAL ===================
             break;
         }
-        pthread_mutex_unlock(&players_mutex); // =================== FIM: REGIÃO CRÍTICA GLOBAL ===================
+        // Do broadcast da troca de turno ate esta corrotina voltar a rodar com o mutex
+        if (waited && trace_enabled) trace_record("despertar", match->cold.handoff_ns, trace_clock(), match->turn_count);
+        pthread_mutex_unlock(&match->mutex); // =================== FIM: REGIÃO CRÍTICA GLOBAL ===================
 
         // Agora é a vez deste jogador, então ele espera por um comando
-        n = recv(player->socket, buffer, sizeof(buffer)-1, 0);
+        // (o intervalo "recv" inclui o tempo que o cliente leva para jogar)
+        uint64_t t_recv = trace_now();
+        n = client_recv(conn, buffer, sizeof(buffer)-1);
         if (n <= 0) {
-            printf("DEBUG: Cliente %s desconectou durante o jogo.\n", player->name);
-            pthread_mutex_lock(&players_mutex);
-            if (!game_over) { // Garante que a lógica de fim de jogo execute apenas uma vez
-                game_over = 1;
-                int other_player_id = (player->id == 0) ? 1 : 0;
-                if (players[other_player_id].socket != 0) {
-                    send_to_player(players[other_player_id].socket, "O adversario desconectou. Jogo encerrado.");
-                }
-                pthread_cond_broadcast(&turn_cond); // Acorda a outra thread para que ela possa sair
+            if (abandon_match(player, "O adversario desconectou. Jogo encerrado.")) {
+                printf("DEBUG: Cliente %s desconectou durante o jogo.\n", player->name);
+                leave_match(player, conn, NULL);
+                return 0;
             }
-            pthread_mutex_unlock(&players_mutex);
-            break; // Sai do loop
+            break; // Partida encerrada pelo adversario: segue para o END abaixo
         }
         buffer[n] = '\0';
         buffer[strcspn(buffer, "\n")] = 0;
+        trace_span("recv", t_recv, match->turn_count);
 
         // Como já garantimos que é o turno do jogador, só precisamos verificar o comando
         if (strncmp(buffer, CMD_FIRE, strlen(CMD_FIRE)) == 0) {
-            handle_fire_command(player, buffer);
+            int turn = match->turn_count;
+            uint64_t t_cmd = trace_now();
+            if (salvo_mode) handle_salvo_command(player, buffer);
+            else handle_fire_command(player, buffer);
+            trace_span(CMD_FIRE, t_cmd, turn); // Engloba as etapas registradas dentro do comando
+        } else if (strncmp(buffer, CMD_STATE, strlen(CMD_STATE)) == 0) {
+            handle_state_command(player); // Nao gasta a vez: o loop volta a esperar o FIRE
         } else {
             send_to_player(player->socket, "Comando invalido. E sua vez de atirar com FIRE.");
             printf("DEBUG: Jogador %s enviou comando invalido durante o turno: '%s'\n", player->name, buffer);
         }
     }
 
-    // Se o jogo terminou e este socket ainda está aberto, envia CMD_END
-    if (player->socket != 0) {
+    return 1;
+}
+
+// Corrotina para lidar com a comunicação de cada cliente. O codigo e sequencial como era com
+// uma thread por cliente; cada espera (recv, pronto, vez) suspende so esta corrotina.
+void *handle_client(void *arg) {
+    Session *session = arg;
+    int client_socket = session->socket;
+    Player *player = session->player; // Ja preenchido quando a conexao veio de outro processo
+    Match *match;
+    char buffer[MAX_MSG];
+    ssize_t n;
+    IoConn conn; // Estado de I/O desta conexao (entrada do anel io_uring ou recv do socket)
+
+    coro_set_local(CORO_LOCAL_SESSION, session);
+    io_conn_open(&conn, client_socket);
+    io_conn_preload(&conn, session->carry, session->carry_len);
+    io_set_thread_conn(&conn);
+
+    printf("DEBUG: Sessao do cliente (socket %d) iniciada.\n", client_socket);
+
+    // Envia a mensagem inicial ANTES de esperar pelo JOIN para evitar deadlock.
+    if (!session->resumed) send_to_player(client_socket, "Conectado. Envie JOIN <nome> [sala].");
+
+    // Agora, espera pelo comando JOIN do cliente (repetido enquanto o nome for recusado)
+    while (player == NULL) {
+        n = client_recv(&conn, buffer, sizeof(buffer) - 1);
+        if (n <= 0) {
+            printf("DEBUG: Cliente (socket %d) desconectou antes de enviar JOIN.\n", client_socket);
+            break;
+        }
+        buffer[n] = '\0';
+        buffer[strcspn(buffer, "\n")] = 0;
+
+        if (strncmp(buffer, CMD_JOIN, strlen(CMD_JOIN)) != 0) {
+            send_to_player(client_socket, "Comando invalido. Use JOIN <seu_nome> [sala].");
+            break;
+        }
+        player = handle_join_command(client_socket, buffer);
+    }
+    if (player == NULL) {
+        io_conn_close(&conn);
+        io_out_forget(client_socket);
+        io_count_syscall();
+        close(client_socket);
+        __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+        trace_thread_exit();
+        session_finish();
+        return NULL;
+    }
+    match = player_match(player);
+    match->cold.sessions[player->id] = session;
+    pthread_mutex_lock(&sessions_mutex);
+    session->player = player;
+    if (session->phase == HANDOFF_PHASE_JOIN) session->phase = HANDOFF_PHASE_PLACEMENT;
+    pthread_mutex_unlock(&sessions_mutex);
+    if (session->resumed) {
+        printf("DEBUG: Jogador %s (ID: %d) retomado do processo anterior.\n", player->name, player->id);
+    } else {
+        printf("DEBUG: Jogador %s (ID: %d) se juntou ao jogo.\n", player->name, player->id);
+    }
+    trace_thread_name(player->name);
+
+    Player *other = &match->players[(player->id == 0) ? 1 : 0];
+    while (1) {
+        if (session->phase == HANDOFF_PHASE_REMATCH) {
+            if (!await_rematch(player, &conn)) return NULL;
+            session->phase = HANDOFF_PHASE_PLACEMENT;
+        }
+        if (!play_match(session, player, &conn)) return NULL;
+
+        // Partida abandonada (ou adversario que ja saiu): envia CMD_END e encerra a sessao
+        if (match->game_over != MATCH_OVER_WON || other->socket == 0) {
+            printf("DEBUG: Cliente %s desconectou e sessao encerrada.\n", player->name);
+            leave_match(player, &conn, CMD_END);
+            return NULL; // A pilha da corrotina volta ao pool
+        }
+        // Partida com vencedor: o END sai, mas a conexao fica aberta para um REMATCH. Um
+        // cliente antigo simplesmente fecha a conexao depois do END.
         send_to_player(player->socket, CMD_END);
-        close(player->socket);
+        session->phase = HANDOFF_PHASE_REMATCH;
     }
-    printf("DEBUG: Cliente %s desconectou e thread encerrada.\n", player->name);
-    pthread_exit(NULL); // Encerrar a thread corretamente
 }
 
-int main() {
-    int server_fd, new_socket;
-    struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    pthread_t tid[MAX_PLAYERS];
-    int player_idx; // Índice para o jogador que está se conectando
+// Mensagem de lotacao pronta de antemao: recusar nao formata nada
+static const char full_message[] = "Jogo cheio. Tente mais tarde.\n";
 
-    // Inicializa players
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        init_player_state(&players[i]); // Usa a nova função de inicialização
-        players[i].id = i;
-        players[i].socket = 0; // 0 significa socket nao conectado/inicializado
-        // =================== INÍCIO: REGIÃO DE PARALELISMO ===================
-        // Cada jogador possui seu próprio mutex para proteger seu estado individual
-        pthread_mutex_init(&players[i].lock, NULL); // Inicializa o mutex para cada jogador
-        // =================== FIM: REGIÃO DE PARALELISMO ===================
+// Recusa uma conexao sem criar sessao. Com mensagem, envia sem bloquear (um cliente lento
+// nao segura a thread de accept); sem mensagem, fecha com RST para nao deixar TIME_WAIT.
+void reject_connection(int fd, const char *msg, size_t len) {
+    io_count_syscall();
+    if (msg) {
+        send(fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } else {
+        struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
     }
+    io_count_syscall();
+    close(fd);
+}
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// Decide o destino de uma conexao recem-aceita: limite por IP, lotacao ou nova sessao
+void admit_connection(IoAccepted *acc) {
 
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(PORT);
+    if (!admission_allow(acc->addr.sin_addr.s_addr)) {
+        admission_stats.rejected_rate++;
+        reject_connection(acc->fd, NULL, 0);
+        return;
+    }
+    if (__atomic_load_n(&connected_clients, __ATOMIC_RELAXED) >= max_clients) {
+        admission_stats.rejected_full++;
+        reject_connection(acc->fd, full_message, sizeof(full_message) - 1);
+        return;
+    }
 
-    bind(server_fd, (struct sockaddr *)&address, sizeof(address));
-    listen(server_fd, MAX_PLAYERS);
+    // Cada turno gera varias mensagens curtas seguidas: sem Nagle, a segunda nao fica
+    // presa esperando o ACK atrasado da primeira (~40 ms por turno)
+    int one = 1;
+    io_count_syscall();
+    setsockopt(acc->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-    printf("Servidor de Batalha Naval iniciado na porta %d...\n", PORT);
+    Session *session = calloc(1, sizeof(Session));
+    if (!session) {
+        reject_connection(acc->fd, full_message, sizeof(full_message) - 1);
+        return;
+    }
+    session->socket = acc->fd;
+
+    int total = __atomic_add_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+    if (session_start(session) < 0) {
+        perror("coro_spawn");
+        __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+        close(acc->fd);
+        free(session);
+        return;
+    }
+    admission_stats.accepted++;
+    printf("DEBUG: Nova conexao aceita (socket %d). Total conectado: %d\n", acc->fd, total);
+}
 
-    while (1) { // Loop infinito para aceitar conexões 
-        // Reinicia o estado do jogo se ele terminou
-        if (game_over) {
-            printf("DEBUG: Jogo anterior terminou. Resetando estado do servidor.\n");
-            pthread_mutex_lock(&players_mutex);
-            game_over = 0;
-            game_started = 0;
-            current_player_turn = -1;
-            num_connected_players = 0; // Resetar contagem de jogadores conectados
-            for (int i = 0; i < MAX_PLAYERS; i++) {
-                // Não inicializa socket aqui, pois ele será atribuído novamente no accept
-                // Apenas reseta o estado do player para uma nova partida
-                init_player_state(&players[i]);
+// --- Troca de processo (--handoff / --takeover) ---
+
+// Para todas as sessoes em um ponto seguro. Quem estiver no meio de um comando termina o
+// comando; quem espera no recv, pela vez ou pelo adversario e acordado por coro_interrupt.
+// Partidas que terminarem nesse meio tempo saem normalmente.
+static void handoff_quiesce(void) {
+    pthread_mutex_lock(&sessions_mutex);
+    __atomic_store_n(&draining, 1, __ATOMIC_RELEASE);
+    while (1) {
+        int running = 0;
+        for (Session *session = sessions; session; session = session->next) {
+            if (session->parked) continue;
+            running++;
+            coro_interrupt(session->coro);
+        }
+        if (running == 0) break;
+        // A interrupcao fica pendente ate a proxima espera; repete ate todas pararem
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += HANDOFF_PARK_POLL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&sessions_cond, &sessions_mutex, &deadline);
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+}
+
+// Troca cancelada: as sessoes paradas voltam a atender as conexoes neste processo
+static void handoff_resume(void) {
+    pthread_mutex_lock(&sessions_mutex);
+    __atomic_store_n(&draining, 0, __ATOMIC_RELEASE);
+    coro_cond_broadcast(&sessions_resume);
+    pthread_mutex_unlock(&sessions_mutex);
+}
+
+static void handoff_fill_client(HandoffClient *out, const Session *session) {
+    out->phase = session->phase;
+    out->carry_len = (uint32_t)session->carry_len;
+    memcpy(out->carry, session->carry, session->carry_len);
+}
+
+// O formato de transferencia guarda o tabuleiro em caracteres e os navios no formato antigo
+// ({x, y, orientacao, comprimento, acertos, simbolo}), independente do registro compacto
+static void handoff_fill_player(HandoffPlayer *hp, const Player *p) {
+    snprintf(hp->name, sizeof(hp->name), "%s", p->name ? p->name : "");
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        for (int y = 0; y < BOARD_SIZE; y++) hp->board[x][y] = player_cell(p, x, y);
+    }
+    for (int k = 0; k < p->num_ships_placed; k++) {
+        const ShipDesc *ship = &p->fleet[k];
+        const ShipType *info = &ship_types[ship->type];
+        hp->ships[k][0] = ship->origin / BOARD_SIZE;
+        hp->ships[k][1] = ship->origin % BOARD_SIZE;
+        hp->ships[k][2] = ship->vertical ? 'V' : 'H';
+        hp->ships[k][3] = info->length;
+        hp->ships[k][4] = ship->hits;
+        hp->ships[k][5] = info->symbol;
+    }
+    hp->num_ships_placed = p->num_ships_placed;
+    hp->ships_sunk = p->ships_sunk;
+    hp->ready = p->ready;
+    hp->pos_submarino = player_count_ships(p, 0);
+    hp->pos_fragata = player_count_ships(p, 1);
+    hp->pos_destroyer = player_count_ships(p, 2);
+}
+
+// Envia as conexoes paradas: as que ainda nao entraram em partida uma a uma e cada partida
+// uma vez, com os sockets dos jogadores conectados. Retorna quantas conexoes foram enviadas
+// ou -1. Todas as sessoes estao paradas, entao o estado das partidas nao muda.
+static int handoff_send_sessions(int ctl) {
+    int sent = 0;
+    pthread_mutex_lock(&sessions_mutex);
+    for (Session *session = sessions; session && sent >= 0; session = session->next) {
+        if (!session->player) {
+            HandoffClient client;
+            memset(&client, 0, sizeof(client));
+            handoff_fill_client(&client, session);
+            if (handoff_send(ctl, HANDOFF_CLIENT, &client, sizeof(client), &session->socket, 1) < 0) sent = -1;
+            else sent++;
+            continue;
+        }
+
+        Match *match = player_match(session->player);
+        Player *other = &match->players[(session->player->id == 0) ? 1 : 0];
+        if (other->socket != 0 && other->id < session->player->id) continue; // Vai junto com o adversario
+
+        HandoffMatch m;
+        int fds[HANDOFF_MAX_FDS];
+        int nfds = 0;
+        memset(&m, 0, sizeof(m));
+        snprintf(m.room, sizeof(m.room), "%s", match->cold.room);
+        m.num_players = match->num_players;
+        m.current_player_turn = match->current_player_turn;
+        m.game_started = match->game_started;
+        m.game_over = match->game_over;
+        m.turn_count = match->turn_count;
+        m.rematch = match->rematch;
+        m.started_ms = match->cold.started_ms;
+        memcpy(m.sunk_order, match->cold.sunk_order, sizeof(m.sunk_order));
+        for (int i = 0; i < PLAYERS_PER_MATCH; i++) {
+            Player *p = &match->players[i];
+            HandoffPlayer *hp = &m.players[i];
+            handoff_fill_player(hp, p);
+            if (p->socket != 0) { // Jogador que ja saiu (partida encerrada) nao tem conexao
+                hp->connected = 1;
+                handoff_fill_client(&hp->client, match->cold.sessions[i]);
+                fds[nfds++] = p->socket;
             }
-            pthread_mutex_unlock(&players_mutex);
         }
+        if (handoff_send(ctl, HANDOFF_MATCH, &m, sizeof(m), fds, nfds) < 0) sent = -1;
+        else sent += nfds;
+    }
+    pthread_mutex_unlock(&sessions_mutex);
+    return sent;
+}
 
-        new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen);
-        if (new_socket < 0) {
-            perror("accept");
+// Lado do processo atual: entrega o listener, para as sessoes e transfere conexoes e partidas.
+// Com o ACK do processo novo, este processo termina; se algo falhar, a troca e cancelada e
+// a funcao retorna com tudo atendido aqui de novo.
+static void handoff_serve(int ctl, int server_fd, const char *ratings_path, const char *results_path) {
+    uint32_t type;
+    int fds[HANDOFF_MAX_FDS];
+    int nfds;
+
+    // O processo novo se apresenta logo apos conectar; um cliente mudo nao trava o accept
+    struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt(ctl, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (handoff_recv(ctl, &type, NULL, 0, fds, &nfds) < 0 || type != HANDOFF_HELLO) {
+        printf("DEBUG: Troca de processo recusada: o processo novo nao se apresentou.\n");
+        close(ctl);
+        return;
+    }
+    tv.tv_sec = 0; // Daqui em diante espera o processo novo o quanto for preciso (ACK ou EOF)
+    setsockopt(ctl, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    uint64_t start = trace_clock();
+    IoAccepted accepted[ACCEPT_BATCH];
+    int count = io_accept_stop(server_fd, accepted, ACCEPT_BATCH);
+    for (int i = 0; i < count; i++) {
+        admit_connection(&accepted[i]); // Viram sessoes e seguem com as demais
+    }
+    // A partir daqui o processo novo aceita: a fila do listener nunca fica sem dono
+    if (handoff_send(ctl, HANDOFF_LISTENER, NULL, 0, &server_fd, 1) < 0) {
+        printf("DEBUG: Troca de processo falhou ao entregar o listener.\n");
+        io_accept_start(server_fd);
+        close(ctl);
+        return;
+    }
+    printf("DEBUG: Troca de processo: listener entregue, parando as conexoes...\n");
+
+    handoff_quiesce();
+    // A fila de saida fica neste processo: o que um cliente lento ainda nao leu sai antes do socket
+    io_out_drain(HANDOFF_OUT_DRAIN_MS);
+    ratings_close(); // O processo novo reabre o arquivo depois do HANDOFF_END
+    results_close(); // Idem; os grupos pendentes vao para o disco antes
+
+    int sent = handoff_send_sessions(ctl);
+    if (sent >= 0 && handoff_send(ctl, HANDOFF_END, NULL, 0, NULL, 0) == 0 &&
+        handoff_recv(ctl, &type, NULL, 0, fds, &nfds) >= 0 && type == HANDOFF_ACK) {
+        printf("DEBUG: Troca de processo concluida: %d conexoes transferidas em %.1f ms. Encerrando.\n",
+               sent, (trace_clock() - start) / 1e6);
+        trace_close();
+        exit(0);
+    }
+
+    printf("DEBUG: Troca de processo falhou; as conexoes continuam neste processo.\n");
+    if (strcmp(ratings_path, "none") != 0) ratings_open(ratings_path, RATINGS_DEFAULT_CAPACITY);
+    if (results_path) results_open(results_path);
+    handoff_resume();
+    io_accept_start(server_fd);
+    close(ctl);
+}
+
+// Sessao herdada de outro processo (ainda nao iniciada)
+static Session *takeover_session(const HandoffClient *client, int fd, Player *player) {
+    Session *session = calloc(1, sizeof(Session));
+    if (!session) {
+        close(fd);
+        return NULL;
+    }
+    session->socket = fd;
+    session->resumed = 1;
+    session->player = player;
+    session->phase = client->phase;
+    if (session->phase < HANDOFF_PHASE_JOIN || session->phase > HANDOFF_PHASE_REMATCH) session->phase = HANDOFF_PHASE_JOIN;
+    session->carry_len = client->carry_len < sizeof(session->carry) ? client->carry_len : sizeof(session->carry);
+    memcpy(session->carry, client->carry, session->carry_len);
+    if (player) player_match(player)->cold.sessions[player->id] = session;
+    return session;
+}
+
+// Tabuleiro e navios no formato de transferencia de volta ao registro compacto. Os dados vem
+// de outro processo: tipos e casas fora do tabuleiro sao ignorados.
+static void takeover_player(Player *p, const HandoffPlayer *hp) {
+    char name[NAME_MAX_LEN];
+    snprintf(name, sizeof(name), "%s", hp->name);
+    if (name[0]) player_set_name(p, name);
+    int placed = hp->num_ships_placed < MAX_SHIPS ? hp->num_ships_placed : MAX_SHIPS;
+    for (int k = 0; k < placed; k++) {
+        const ShipType *info = get_ship_type_info((char[]){ (char)hp->ships[k][5], '\0' });
+        int x = hp->ships[k][0], y = hp->ships[k][1];
+        if (!info || !is_valid_position(p, x, y, (char)hp->ships[k][2], info->length)) continue;
+        ShipDesc *ship = &p->fleet[p->num_ships_placed++];
+        ship->origin = (uint8_t)(x * BOARD_SIZE + y);
+        ship->type = (uint8_t)(info - ship_types);
+        ship->vertical = (hp->ships[k][2] == 'V' || hp->ships[k][2] == 'v');
+        ship->hits = (uint8_t)hp->ships[k][4];
+        p->ships |= ship_cells(*ship);
+    }
+    for (int x = 0; x < BOARD_SIZE; x++) {
+        for (int y = 0; y < BOARD_SIZE; y++) {
+            if (hp->board[x][y] == 'X') p->hits |= cell_bit(x, y);
+            if (hp->board[x][y] == 'O') p->misses |= cell_bit(x, y);
+        }
+    }
+    p->ships_sunk = (uint8_t)hp->ships_sunk;
+    p->ready = (uint8_t)hp->ready;
+}
+
+// Recria uma partida herdada. As sessoes dos jogadores conectados vao para a lista pending.
+static void takeover_match(const HandoffMatch *m, int *fds, int nfds, Session **pending) {
+    Match *match = match_create(m->room);
+    if (!match) {
+        for (int i = 0; i < nfds; i++) close(fds[i]);
+        return;
+    }
+    match->num_players = m->num_players;
+    match->current_player_turn = m->current_player_turn;
+    match->game_started = m->game_started;
+    match->game_over = m->game_over;
+    match->turn_count = m->turn_count;
+    match->rematch = (uint8_t)m->rematch;
+    match->cold.started_ms = m->started_ms;
+    memcpy(match->cold.sunk_order, m->sunk_order, sizeof(match->cold.sunk_order));
+
+    int next_fd = 0;
+    for (int i = 0; i < PLAYERS_PER_MATCH; i++) {
+        const HandoffPlayer *hp = &m->players[i];
+        Player *p = &match->players[i];
+        takeover_player(p, hp);
+        if (!hp->connected || next_fd >= nfds) continue;
+
+        p->socket = fds[next_fd++];
+        Session *session = takeover_session(&hp->client, p->socket, p);
+        if (!session) {
+            p->socket = 0;
             continue;
         }
+        lobby_register_name(p->name);
+        match->refs++;
+        session->next = *pending;
+        *pending = session;
+    }
 
-        // =================== INÍCIO: REGIÃO CRÍTICA GLOBAL ===================
-        pthread_mutex_lock(&players_mutex); 
-        if (num_connected_players < MAX_PLAYERS) {
-            player_idx = num_connected_players; // Pega o próximo slot disponível
-            players[player_idx].socket = new_socket;
-            // =================== INÍCIO: REGIÃO DE PARALELISMO ===================
-            // Cria uma thread para cada jogador conectado. Cada thread executa a função handle_client.
-            pthread_create(&tid[player_idx], NULL, handle_client, (void *)&players[player_idx]);
-            pthread_detach(tid[player_idx]); // Desatacha a thread para não precisar de pthread_join
-            // =================== FIM: REGIÃO DE PARALELISMO ===================
-            num_connected_players++;
-            printf("DEBUG: Nova conexao aceita. Slot %d. Total conectado: %d\n", player_idx, num_connected_players);
-            
+    // Partida que esperava o segundo jogador volta a ficar aberta
+    if (match->num_players == 1 && !match->game_over && match->refs > 0) {
+        if (lobby_reopen(match->cold.room, match) == 0) match->refs++;
+        else printf("DEBUG: Sala %s herdada ja estava aberta; a partida nao recebera adversario.\n", match->cold.room);
+    }
+    if (match->refs == 0) match_destroy(match);
+}
+
+typedef struct {
+    int ctl;
+    const char *ratings_path;
+    const char *results_path;
+    const char *control_tmp;  // Socket de controle proprio, criado com nome provisorio
+    const char *control_path; // Nome definitivo (o mesmo do processo anterior)
+} Takeover;
+
+// Lado do processo novo (em uma thread, enquanto a principal ja aceita conexoes): recebe as
+// conexoes e partidas, e so as coloca para rodar ao receber HANDOFF_END completo. Se a
+// transferencia quebrar no meio, este processo sai e o anterior continua com tudo.
+static void *takeover_thread(void *arg) {
+    Takeover *t = arg;
+    Session *pending = NULL;
+    int received = 0;
+    HandoffMatch m; // Maior mensagem possivel
+    uint32_t type;
+    int fds[HANDOFF_MAX_FDS];
+    int nfds;
+
+    while (1) {
+        ssize_t len = handoff_recv(t->ctl, &type, &m, sizeof(m), fds, &nfds);
+        if (len < 0) {
+            fprintf(stderr, "Troca de processo interrompida; o processo anterior continua atendendo.\n");
+            exit(1);
+        }
+        if (type == HANDOFF_END) break;
+        if (type == HANDOFF_CLIENT && len == (ssize_t)sizeof(HandoffClient) && nfds == 1) {
+            Session *session = takeover_session((HandoffClient *)&m, fds[0], NULL);
+            if (session) {
+                session->next = pending;
+                pending = session;
+            }
+        } else if (type == HANDOFF_MATCH && len == (ssize_t)sizeof(HandoffMatch)) {
+            takeover_match(&m, fds, nfds, &pending);
         } else {
-            send(new_socket, "Jogo cheio. Tente mais tarde.\n", strlen("Jogo cheio. Tente mais tarde.\n"), 0);
-            close(new_socket);
-            printf("DEBUG: Conexao rejeitada: Jogo cheio (socket %d).\n", new_socket);
+            for (int i = 0; i < nfds; i++) close(fds[i]);
         }
-        pthread_mutex_unlock(&players_mutex); 
-        // =================== FIM: REGIÃO CRÍTICA GLOBAL ===================
     }
 
-    // Este loop nunca será alcançado em um servidor infinito.
-    // pthread_join(tid[i], NULL); está agora no handle_client via pthread_detach.
+    if (strcmp(t->ratings_path, "none") != 0 && ratings_open(t->ratings_path, RATINGS_DEFAULT_CAPACITY) < 0) {
+        printf("DEBUG: Ranking persistente desativado (falha ao abrir %s).\n", t->ratings_path);
+    }
+    if (t->results_path && results_open(t->results_path) < 0) {
+        printf("DEBUG: Exportacao de resultados desativada (falha ao abrir %s).\n", t->results_path);
+    }
+    while (pending) {
+        Session *session = pending;
+        pending = session->next;
+        __atomic_add_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+        if (session_start(session) < 0) {
+            perror("coro_spawn");
+            __atomic_sub_fetch(&connected_clients, 1, __ATOMIC_RELAXED);
+            close(session->socket);
+            free(session);
+            continue;
+        }
+        received++;
+    }
+    handoff_send(t->ctl, HANDOFF_ACK, NULL, 0, NULL, 0);
+    close(t->ctl);
+
+    if (t->control_tmp && rename(t->control_tmp, t->control_path) < 0) perror("handoff: rename");
+    pthread_mutex_lock(&takeover_mutex);
+    __atomic_store_n(&takeover_pending, 0, __ATOMIC_RELEASE);
+    coro_cond_broadcast(&takeover_cond);
+    pthread_mutex_unlock(&takeover_mutex);
+    printf("DEBUG: Troca de processo concluida: %d conexoes retomadas.\n", received);
+    return NULL;
+}
 
-    close(server_fd);
+// SIGTERM/SIGINT ficam bloqueados em todas as threads e chegam so aqui, por sigwait: o
+// encerramento roda fora de contexto de sinal e pode travar mutexes e esperar threads.
+static sigset_t stop_signals;
+
+static void *shutdown_thread(void *arg) {
+    (void)arg;
+    int sig;
+    while (sigwait(&stop_signals, &sig) != 0) {
+    }
+    printf("DEBUG: Sinal %d recebido: gravando o que falta antes de encerrar.\n", sig);
+    ratings_close(); // Aplica os resultados ainda na fila
+    results_close(); // Grava o grupo incompleto
+    trace_close();   // Descarrega os buffers das sessoes e fecha o JSON
     printf("Servidor encerrado.\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[]) {
+    int server_fd;
+    struct sockaddr_in address;
+    IoBackendKind requested_io = IO_BACKEND_BLOCKING;
+    const char *ratings_path = "ratings.db";
+    const char *trace_path = NULL;
+    const char *results_path = NULL;
+    const char *handoff_path = NULL;
+    const char *takeover_path = NULL;
+    int control_fd = -1;
+    int backlog = LISTEN_BACKLOG_DEFAULT;
+    unsigned ip_rate = ADMISSION_RATE_DEFAULT;
+    unsigned ip_burst = ADMISSION_BURST_DEFAULT;
+    int workers = 0; // Trabalhadoras das corrotinas (0 = uma por CPU)
+
+    // Opcoes de linha de comando
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--io") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "uring") == 0) {
+                requested_io = IO_BACKEND_URING;
+            } else if (strcmp(argv[i], "blocking") != 0) {
+                fprintf(stderr, "Backend de I/O desconhecido: %s (use uring ou blocking)\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ratings") == 0 && i + 1 < argc) {
+            ratings_path = argv[++i];
+        } else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc) {
+            max_clients = atoi(argv[++i]);
+            if (max_clients < PLAYERS_PER_MATCH) max_clients = PLAYERS_PER_MATCH;
+        } else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc) {
+            backlog = atoi(argv[++i]);
+            if (backlog < 1) backlog = 1;
+        } else if (strcmp(argv[i], "--ip-rate") == 0 && i + 1 < argc) {
+            ip_rate = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ip-burst") == 0 && i + 1 < argc) {
+            ip_burst = (unsigned)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--handoff") == 0 && i + 1 < argc) {
+            handoff_path = argv[++i];
+        } else if (strcmp(argv[i], "--takeover") == 0 && i + 1 < argc) {
+            takeover_path = argv[++i];
+        } else if (strcmp(argv[i], "--results") == 0 && i + 1 < argc) {
+            results_path = argv[++i];
+        } else if (strcmp(argv[i], "--salvo") == 0) {
+            salvo_mode = 1;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Uso: %s [--io uring|blocking] [--ratings <arquivo>|none] [--max-clients N]\n"
+                            "          [--backlog N] [--ip-rate conexoes/s] [--ip-burst N] [--trace <arquivo.json>]\n"
+                            "          [--handoff <socket>] [--takeover <socket>] [--workers N] [--salvo]\n"
+                            "          [--results <arquivo>]\n", argv[0]);
+            return 1;
+        }
+    }
 
-    // Destroi mutexes (isso só aconteceria se o servidor fosse desligado, o que é raro para um servidor)
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        pthread_mutex_destroy(&players[i].lock);
+    // Um cliente que some no meio de um envio nao pode derrubar o servidor inteiro
+    signal(SIGPIPE, SIG_IGN);
+    // Antes de criar qualquer thread: todas herdam a mascara e o sinal fica para shutdown_thread
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGTERM);
+    sigaddset(&stop_signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    if (lobby_init() < 0) return 1;
+
+    // =================== INÍCIO: REGIÃO DE PARALELISMO ===================
+    // Poucas threads trabalhadoras executam as corrotinas de todos os clientes
+    workers = coro_init(workers);
+    if (workers < 0) {
+        fprintf(stderr, "Falha ao criar as threads trabalhadoras.\n");
+        return 1;
     }
-    pthread_mutex_destroy(&players_mutex);
-    pthread_cond_destroy(&all_players_ready_cond);
-    pthread_cond_destroy(&turn_cond);
+    // =================== FIM: REGIÃO DE PARALELISMO ===================
+
+    int takeover_ctl = -1;
+    if (takeover_path) {
+        // Assume o listener do processo em execucao em vez de abrir a porta
+        uint32_t type;
+        int fds[HANDOFF_MAX_FDS];
+        int nfds = 0;
+        takeover_ctl = handoff_connect(takeover_path);
+        if (takeover_ctl < 0 || handoff_recv(takeover_ctl, &type, NULL, 0, fds, &nfds) < 0 ||
+            type != HANDOFF_LISTENER || nfds != 1) {
+            fprintf(stderr, "Troca de processo: nao foi possivel receber o listener de %s.\n", takeover_path);
+            return 1;
+        }
+        server_fd = fds[0];
+        takeover_pending = 1;
+    } else {
+        server_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int opt = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = INADDR_ANY;
+        address.sin_port = htons(PORT);
+
+        bind(server_fd, (struct sockaddr *)&address, sizeof(address));
+        // Fila de conexoes pendentes grande o bastante para uma onda de reconexoes
+        listen(server_fd, backlog);
+    }
+    admission_configure(ip_rate, ip_burst);
+
+    // No modo --takeover o ranking e aberto depois que o processo anterior o fecha
+    if (!takeover_path && strcmp(ratings_path, "none") != 0 && ratings_open(ratings_path, RATINGS_DEFAULT_CAPACITY) < 0) {
+        printf("DEBUG: Ranking persistente desativado (falha ao abrir %s).\n", ratings_path);
+    }
+
+    // Como o ranking, o arquivo de resultados passa de um processo para o outro na troca
+    if (!takeover_path && results_path) {
+        if (results_open(results_path) == 0) {
+            printf("DEBUG: Resultados das partidas exportados em %s (formato colunar).\n", results_path);
+        } else {
+            printf("DEBUG: Exportacao de resultados desativada (falha ao abrir %s).\n", results_path);
+        }
+    }
+
+    // Socket de controle para a proxima troca. Se o caminho ainda pertence ao processo
+    // anterior, o socket nasce com nome provisorio e assume o nome quando a troca termina.
+    char control_tmp[256];
+    int control_renamed = takeover_path && handoff_path && strcmp(takeover_path, handoff_path) == 0;
+    if (handoff_path) {
+        snprintf(control_tmp, sizeof(control_tmp), "%s.%d", handoff_path, (int)getpid());
+        control_fd = handoff_listen(control_renamed ? control_tmp : handoff_path);
+    }
+
+    if (trace_path && trace_open(trace_path) == 0) {
+        printf("DEBUG: Rastreamento de latencia ativo em %s (formato Chrome trace).\n", trace_path);
+    }
+
+    io_backend_init(requested_io, workers);
+    io_accept_start(server_fd);
+    if (control_fd >= 0) io_accept_watch(control_fd);
+
+    printf("Servidor de Batalha Naval iniciado na porta %d (I/O %s, %d trabalhadoras)...\n", PORT,
+           io_backend_name(io_backend), workers);
+
+    pthread_t shutdown_tid;
+    if (pthread_create(&shutdown_tid, NULL, shutdown_thread, NULL) == 0) pthread_detach(shutdown_tid);
+
+    Takeover takeover = { takeover_ctl, ratings_path, results_path, control_renamed ? control_tmp : NULL, handoff_path };
+    if (takeover_path) {
+        // As conexoes herdadas chegam em outra thread: o accept nao espera por elas
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, takeover_thread, &takeover) == 0) pthread_detach(tid);
+    }
+
+    IoAccepted accepted[ACCEPT_BATCH];
+    AdmissionStats reported = admission_stats;
+    time_t last_report = time(NULL);
+
+    while (1) { // Loop infinito para aceitar conexões 
+        // Cada despertar drena ate ACCEPT_BATCH conexoes pendentes
+        int count = io_accept_batch(server_fd, accepted, ACCEPT_BATCH);
+        if (count < 0) {
+            perror("accept");
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            admit_connection(&accepted[i]);
+        }
+
+        // Pedido de troca de processo (so depois de terminar a que trouxe este processo)
+        if (control_fd >= 0 && !__atomic_load_n(&takeover_pending, __ATOMIC_ACQUIRE)) {
+            int ctl = accept4(control_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (ctl >= 0) handoff_serve(ctl, server_fd, ratings_path, results_path);
+        }
+
+        // Recusas sao contadas, nao impressas uma a uma: resumo no maximo uma vez por segundo
+        time_t now = time(NULL);
+        if (now != last_report && (admission_stats.rejected_rate != reported.rejected_rate ||
+                                   admission_stats.rejected_full != reported.rejected_full)) {
+            printf("DEBUG: Admissao: %lu aceitas, %lu recusadas por limite de IP, %lu por lotacao (desde o ultimo resumo).\n",
+                   admission_stats.accepted - reported.accepted,
+                   admission_stats.rejected_rate - reported.rejected_rate,
+                   admission_stats.rejected_full - reported.rejected_full);
+            reported = admission_stats;
+            last_report = now;
+        }
+    }
+
+    // Este loop nunca será alcançado em um servidor infinito.
+    // As trabalhadoras sao desatachadas, entao nao ha pthread_join.
+
+    close(server_fd);
+    ratings_close();
+    results_close();
+    trace_close();
+    printf("Servidor encerrado.\n");
 
     return 0;
-}
\ No newline at end of file
+}
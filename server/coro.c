@@ -0,0 +1,504 @@
+#define _GNU_SOURCE // MAP_NORESERVE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+#include "coro.h"
+
+// Estados de uma corrotina
+#define CORO_RUNNING 0 // Executando em uma trabalhadora
+#define CORO_READY 1   // Na fila de prontas
+#define CORO_WAIT 2    // Suspensa esperando um coro_cond_broadcast
+#define CORO_WAIT_IO 3 // Suspensa esperando tambem o descritor vigiado (ou coro_interrupt)
+#define CORO_FREE 4    // Terminou: no pool, com a pilha
+
+#define WATCH_NOTIFY (-2) // watch_fd de coro_watch_notify: eventos sem descritor
+
+struct Coro {
+#if defined(__x86_64__)
+    void *sp; // Topo da pilha salvo enquanto a corrotina esta suspensa
+#else
+    ucontext_t ctx;
+#endif
+    char *stack; // Base da pilha (CORO_STACK_SIZE bytes)
+    void *(*fn)(void *);
+    void *arg;
+    int state;       // CORO_* (acesso atomico)
+    int io_ready;    // Evento no descritor vigiado desde a ultima espera (acesso atomico)
+    int io_seen;     // Evento consumido por coro_cond_wait e ainda nao entregue a coro_wait_io
+    int interrupted; // coro_interrupt pendente (acesso atomico)
+    int watch_fd;    // -1: nenhum; WATCH_NOTIFY: eventos por coro_notify_io
+    int id;
+    void *locals[CORO_LOCALS];
+    struct Coro *next; // Fila de prontas ou pool
+};
+
+struct CoroWaiter {
+    Coro *coro;
+    int linked; // 0 depois que o broadcast a tirou da lista
+    struct CoroWaiter *prev;
+    struct CoroWaiter *next;
+};
+
+// Fila de prontas, compartilhada pelas trabalhadoras
+static pthread_mutex_t runq_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t runq_cond = PTHREAD_COND_INITIALIZER;
+static Coro *runq_head = NULL;
+static Coro *runq_tail = NULL;
+static int idle_workers = 0;
+
+// Corrotinas terminadas, reaproveitadas com a pilha por coro_spawn
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Coro *pool = NULL;
+static int next_id = 0;
+
+static int epoll_fd = -1;
+static unsigned long epoll_syscalls = 0;
+
+static void count_epoll(void) {
+    __atomic_add_fetch(&epoll_syscalls, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long coro_syscall_count(void) {
+    return __atomic_load_n(&epoll_syscalls, __ATOMIC_RELAXED);
+}
+
+static __thread Coro *current = NULL;
+static __thread void *thread_locals[CORO_LOCALS];
+// Acao pedida pela corrotina que acabou de suspender, executada pela trabalhadora ja na
+// propria pilha (ex.: soltar o mutex da condicao): antes disso outra trabalhadora poderia
+// retomar a corrotina enquanto ela ainda usa a pilha.
+static __thread void (*after_park)(Coro *, void *) = NULL;
+static __thread void *after_arg = NULL;
+
+// --- Troca de contexto ---
+
+#if defined(__x86_64__)
+static __thread void *worker_sp = NULL;
+
+// Salva os registradores preservados entre chamadas na pilha atual, guarda o topo em *from
+// e continua na pilha to (salva do mesmo jeito ou montada por ctx_init)
+void coro_switch(void **from, void *to);
+__asm__(".text\n"
+        ".globl coro_switch\n"
+        ".type coro_switch, @function\n"
+        "coro_switch:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size coro_switch, .-coro_switch\n");
+#else
+static __thread ucontext_t worker_ctx;
+#endif
+
+static void coro_entry(void);
+
+// Marcador no endereco mais baixo da pilha. O estouro em si cai na pagina de guarda logo
+// abaixo (SIGSEGV na hora); o marcador so pega escritas que pulam a guarda sem toca-la e
+// serve de diagnostico com o id da corrotina.
+#define CORO_STACK_CANARY 0x5ac0ffeec0ffee5aULL
+
+static void stack_check(Coro *c) {
+    if (*(volatile unsigned long long *)c->stack != CORO_STACK_CANARY) {
+        fprintf(stderr, "ERRO: a corrotina %d estourou a pilha de %d KB (CORO_STACK_SIZE).\n", c->id,
+                CORO_STACK_SIZE / 1024);
+        abort();
+    }
+}
+
+static void ctx_init(Coro *c) {
+    *(unsigned long long *)c->stack = CORO_STACK_CANARY;
+#if defined(__x86_64__)
+    // Primeira troca: os 6 registradores saem zerados e o ret cai em coro_entry com a pilha
+    // alinhada como na entrada de uma funcao (o endereco de retorno falso e NULL)
+    void **sp = (void **)(c->stack + CORO_STACK_SIZE);
+    *--sp = NULL;
+    *--sp = (void *)coro_entry;
+    for (int i = 0; i < 6; i++) *--sp = NULL;
+    c->sp = sp;
+#else
+    getcontext(&c->ctx);
+    c->ctx.uc_stack.ss_sp = c->stack;
+    c->ctx.uc_stack.ss_size = CORO_STACK_SIZE;
+    c->ctx.uc_link = NULL;
+    makecontext(&c->ctx, coro_entry, 0);
+#endif
+}
+
+// Trabalhadora -> corrotina
+static void ctx_resume(Coro *c) {
+#if defined(__x86_64__)
+    coro_switch(&worker_sp, c->sp);
+#else
+    swapcontext(&worker_ctx, &c->ctx);
+#endif
+}
+
+// Corrotina -> trabalhadora. after roda na trabalhadora depois que a pilha da corrotina foi
+// abandonada. Nada de __thread e lido aqui depois da troca: a volta pode ser em outra thread
+// (e a funcao fica fora de linha para nao levar esse cuidado para quem a chama).
+static __attribute__((noinline)) void coro_park(Coro *c, void (*after)(Coro *, void *), void *arg) {
+    after_park = after;
+    after_arg = arg;
+#if defined(__x86_64__)
+    coro_switch(&c->sp, worker_sp);
+#else
+    swapcontext(&c->ctx, &worker_ctx);
+#endif
+}
+
+// --- Fila de prontas ---
+
+static void runq_push_list(Coro *head, Coro *tail) {
+    pthread_mutex_lock(&runq_mutex);
+    if (runq_tail) runq_tail->next = head;
+    else runq_head = head;
+    runq_tail = tail;
+    if (idle_workers > 0) {
+        if (head == tail) pthread_cond_signal(&runq_cond);
+        else pthread_cond_broadcast(&runq_cond);
+    }
+    pthread_mutex_unlock(&runq_mutex);
+}
+
+static void runq_push(Coro *c) {
+    c->next = NULL;
+    runq_push_list(c, c);
+}
+
+static Coro *runq_pop(void) {
+    pthread_mutex_lock(&runq_mutex);
+    while (!runq_head) {
+        idle_workers++;
+        pthread_cond_wait(&runq_cond, &runq_mutex);
+        idle_workers--;
+    }
+    Coro *c = runq_head;
+    runq_head = c->next;
+    if (!runq_head) runq_tail = NULL;
+    pthread_mutex_unlock(&runq_mutex);
+    c->next = NULL;
+    return c;
+}
+
+// Tira a corrotina da espera (se ela estava no estado expected). So quem vence a troca de
+// estado a coloca na fila: um evento e um broadcast simultaneos nao a acordam duas vezes.
+static int try_wake(Coro *c, int expected) {
+    return __atomic_compare_exchange_n(&c->state, &expected, CORO_READY, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// --- Pool de pilhas ---
+
+// Mais CORO_SLAB_STACKS pilhas em um so mmap. Cada pilha tem uma pagina PROT_NONE logo abaixo
+// (a pilha cresce para baixo), entao um estouro falha na hora em vez de corromper a vizinha.
+// Cada guarda parte o mapeamento: sao 2 mapeamentos por pilha, e o kernel limita os de um
+// processo (vm.max_map_count, ~65 mil por padrao).
+static int pool_grow(void) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t slot = page + CORO_STACK_SIZE;
+    size_t size = (size_t)CORO_SLAB_STACKS * slot;
+    char *stacks = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stacks == MAP_FAILED) return -1;
+    for (int i = 0; i < CORO_SLAB_STACKS; i++) {
+        if (mprotect(stacks + (size_t)i * slot, page, PROT_NONE) != 0) {
+            munmap(stacks, size);
+            return -1;
+        }
+    }
+    Coro *coros = calloc(CORO_SLAB_STACKS, sizeof(Coro));
+    if (!coros) {
+        munmap(stacks, size);
+        return -1;
+    }
+    for (int i = 0; i < CORO_SLAB_STACKS; i++) {
+        coros[i].stack = stacks + (size_t)i * slot + page;
+        coros[i].state = CORO_FREE;
+        coros[i].watch_fd = -1;
+        coros[i].next = pool;
+        pool = &coros[i];
+    }
+    return 0;
+}
+
+// Executado pela trabalhadora quando a corrotina termina
+static void park_exit(Coro *c, void *arg) {
+    (void)arg;
+    if (c->watch_fd >= 0) {
+        count_epoll();
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->watch_fd, NULL);
+    }
+    c->watch_fd = -1;
+    // Devolve as paginas tocadas: a memoria acompanha as sessoes vivas, nao o pico
+    madvise(c->stack, CORO_STACK_SIZE, MADV_DONTNEED);
+    __atomic_store_n(&c->state, CORO_FREE, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&pool_mutex);
+    c->next = pool;
+    pool = c;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+static void coro_entry(void) {
+    Coro *c = coro_self();
+    c->fn(c->arg);
+    coro_park(c, park_exit, NULL); // Nao volta
+    abort();
+}
+
+// --- Trabalhadoras e thread de eventos ---
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    while (1) {
+        Coro *c = runq_pop();
+        __atomic_store_n(&c->state, CORO_RUNNING, __ATOMIC_SEQ_CST);
+        current = c;
+        ctx_resume(c);
+        current = NULL;
+        stack_check(c); // A corrotina suspendeu (coro_park) ou terminou (park_exit)
+        if (after_park) {
+            void (*after)(Coro *, void *) = after_park;
+            after_park = NULL;
+            after(c, after_arg);
+        }
+    }
+    return NULL;
+}
+
+static void *poller_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[CORO_EPOLL_BATCH];
+    while (1) {
+        count_epoll();
+        int n = epoll_wait(epoll_fd, events, CORO_EPOLL_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("coro: epoll_wait");
+            return NULL;
+        }
+        // Todas as corrotinas acordadas entram na fila de uma vez
+        Coro *head = NULL;
+        Coro *tail = NULL;
+        for (int i = 0; i < n; i++) {
+            Coro *c = events[i].data.ptr;
+            __atomic_store_n(&c->io_ready, 1, __ATOMIC_SEQ_CST);
+            if (!try_wake(c, CORO_WAIT_IO)) continue;
+            c->next = NULL;
+            if (tail) tail->next = c;
+            else head = c;
+            tail = c;
+        }
+        if (head) runq_push_list(head, tail);
+    }
+}
+
+int coro_init(int workers) {
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0) workers = 1;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("coro: epoll_create1");
+        return -1;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, poller_main, NULL) != 0) return -1;
+    pthread_detach(tid);
+    int created = 0;
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&tid, NULL, worker_main, NULL) != 0) break;
+        pthread_detach(tid);
+        created++;
+    }
+    return created > 0 ? created : -1;
+}
+
+Coro *coro_spawn(void *(*fn)(void *), void *arg) {
+    pthread_mutex_lock(&pool_mutex);
+    if (!pool && pool_grow() < 0) {
+        pthread_mutex_unlock(&pool_mutex);
+        return NULL;
+    }
+    Coro *c = pool;
+    pool = c->next;
+    int id = ++next_id;
+    pthread_mutex_unlock(&pool_mutex);
+
+    c->fn = fn;
+    c->arg = arg;
+    c->io_ready = 0;
+    c->io_seen = 0;
+    c->interrupted = 0;
+    c->watch_fd = -1;
+    c->id = id;
+    memset(c->locals, 0, sizeof(c->locals));
+    ctx_init(c);
+    __atomic_store_n(&c->state, CORO_READY, __ATOMIC_SEQ_CST);
+    runq_push(c);
+    return c;
+}
+
+// Fora de linha de proposito: o compilador pode reaproveitar o endereco de uma variavel
+// __thread dentro de uma funcao, e a corrotina pode ter mudado de thread desde a leitura
+__attribute__((noinline)) Coro *coro_self(void) {
+    return current;
+}
+
+int coro_id(void) {
+    Coro *c = coro_self();
+    return c ? c->id : 0;
+}
+
+__attribute__((noinline)) void *coro_local(int slot) {
+    Coro *c = current;
+    return c ? c->locals[slot] : thread_locals[slot];
+}
+
+__attribute__((noinline)) void coro_set_local(int slot, void *value) {
+    Coro *c = current;
+    if (c) c->locals[slot] = value;
+    else thread_locals[slot] = value;
+}
+
+// --- Esperas ---
+
+int coro_watch(int fd) {
+    Coro *c = coro_self();
+    if (!c) return -1;
+    if (c->watch_fd >= 0) coro_unwatch();
+    // Edge-triggered: cada evento acorda uma vez; io_ready lembra dele ate a proxima espera
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+    count_epoll();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("coro: epoll_ctl");
+        return -1;
+    }
+    c->watch_fd = fd;
+    return 0;
+}
+
+void coro_unwatch(void) {
+    Coro *c = coro_self();
+    if (!c || c->watch_fd == -1) return;
+    if (c->watch_fd >= 0) {
+        count_epoll();
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->watch_fd, NULL);
+    }
+    c->watch_fd = -1;
+}
+
+void coro_watch_notify(void) {
+    Coro *c = coro_self();
+    if (!c) return;
+    if (c->watch_fd != -1) coro_unwatch();
+    c->watch_fd = WATCH_NOTIFY;
+}
+
+// Mesmo protocolo da thread de eventos: io_ready antes do estado
+void coro_notify_io(Coro *coro) {
+    __atomic_store_n(&coro->io_ready, 1, __ATOMIC_SEQ_CST);
+    if (try_wake(coro, CORO_WAIT_IO)) runq_push(coro);
+}
+
+// Espera por I/O: o estado muda antes de olhar io_ready e a thread de eventos marca io_ready
+// antes de olhar o estado, entao um evento no meio da suspensao nunca se perde
+static void park_io(Coro *c, void *arg) {
+    (void)arg;
+    __atomic_store_n(&c->state, CORO_WAIT_IO, __ATOMIC_SEQ_CST);
+    if ((__atomic_load_n(&c->io_ready, __ATOMIC_SEQ_CST) || __atomic_load_n(&c->interrupted, __ATOMIC_SEQ_CST)) &&
+        try_wake(c, CORO_WAIT_IO)) {
+        runq_push(c);
+    }
+}
+
+int coro_wait_io(void) {
+    Coro *c = coro_self();
+    if (!c) return 0;
+    if (!__atomic_exchange_n(&c->io_ready, 0, __ATOMIC_SEQ_CST) && !c->io_seen &&
+        !__atomic_load_n(&c->interrupted, __ATOMIC_SEQ_CST)) {
+        coro_park(c, park_io, NULL);
+        __atomic_store_n(&c->io_ready, 0, __ATOMIC_SEQ_CST);
+    }
+    c->io_seen = 0;
+    return __atomic_exchange_n(&c->interrupted, 0, __ATOMIC_SEQ_CST) ? -1 : 0;
+}
+
+typedef struct {
+    pthread_mutex_t *mutex;
+    int watch_io;
+} CondPark;
+
+static void park_cond(Coro *c, void *arg) {
+    // arg esta na pilha da corrotina: e copiado antes de ela poder ser retomada
+    CondPark *p = arg;
+    pthread_mutex_t *mutex = p->mutex;
+    int watch_io = p->watch_io;
+
+    __atomic_store_n(&c->state, watch_io ? CORO_WAIT_IO : CORO_WAIT, __ATOMIC_SEQ_CST);
+    int woken = watch_io && (__atomic_load_n(&c->io_ready, __ATOMIC_SEQ_CST) ||
+                             __atomic_load_n(&c->interrupted, __ATOMIC_SEQ_CST));
+    // O mutex foi travado por esta mesma thread, antes da troca
+    pthread_mutex_unlock(mutex);
+    if (woken && try_wake(c, CORO_WAIT_IO)) runq_push(c);
+}
+
+int coro_cond_wait(CoroCond *cond, pthread_mutex_t *mutex, int watch_io) {
+    Coro *c = coro_self();
+    CoroWaiter w = { c, 1, cond->tail, NULL };
+    if (cond->tail) cond->tail->next = &w;
+    else cond->head = &w;
+    cond->tail = &w;
+
+    CondPark p = { mutex, watch_io && c->watch_fd != -1 };
+    coro_park(c, park_cond, &p);
+
+    pthread_mutex_lock(mutex);
+    if (w.linked) { // Acordou por evento: sai da lista antes que um broadcast a encontre
+        if (w.prev) w.prev->next = w.next;
+        else cond->head = w.next;
+        if (w.next) w.next->prev = w.prev;
+        else cond->tail = w.prev;
+    }
+    if (!p.watch_io) return 0;
+    int io = __atomic_exchange_n(&c->io_ready, 0, __ATOMIC_SEQ_CST);
+    if (io) c->io_seen = 1; // O proximo coro_wait_io nao espera por um evento ja consumido
+    int interrupted = __atomic_exchange_n(&c->interrupted, 0, __ATOMIC_SEQ_CST);
+    return io || interrupted;
+}
+
+void coro_cond_broadcast(CoroCond *cond) {
+    CoroWaiter *w = cond->head;
+    cond->head = NULL;
+    cond->tail = NULL;
+    while (w) {
+        // Com o mutex travado aqui a corrotina nao sai da espera, entao w continua valido
+        CoroWaiter *next = w->next;
+        Coro *c = w->coro;
+        w->linked = 0;
+        if (try_wake(c, CORO_WAIT) || try_wake(c, CORO_WAIT_IO)) runq_push(c);
+        w = next;
+    }
+}
+
+void coro_interrupt(Coro *coro) {
+    __atomic_store_n(&coro->interrupted, 1, __ATOMIC_SEQ_CST);
+    if (try_wake(coro, CORO_WAIT_IO)) runq_push(coro);
+}
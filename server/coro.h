@@ -0,0 +1,86 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <pthread.h>
+
+// Corrotinas para as sessoes dos jogadores (escalonamento M:N). Cada conexao roda em uma
+// corrotina com pilha pequena e poucas threads trabalhadoras se revezam entre elas. O codigo
+// da sessao continua sequencial: esperar o socket (coro_wait_io) ou uma condicao da partida
+// (coro_cond_wait) suspende so a corrotina, e a trabalhadora segue com outra. Uma thread de
+// eventos (epoll) acorda quem esperava pelo descritor vigiado.
+//
+// Uma corrotina pode voltar em outra trabalhadora depois de suspensa, entao nao pode manter
+// um pthread_mutex travado atraves de uma espera (coro_cond_wait solta e retrava o mutex
+// do jeito certo). Variaveis __thread tambem mudariam no meio da sessao: o estado por
+// sessao fica nos slots de coro_local.
+
+#define CORO_STACK_SIZE (64 * 1024) // Reservada por corrotina; so as paginas tocadas ocupam memoria
+#define CORO_SLAB_STACKS 64         // Pilhas por mmap (cada uma com sua pagina de guarda)
+#define CORO_EPOLL_BATCH 256        // Eventos tratados por despertar da thread de eventos
+
+// Slots de estado por sessao (coro_local). Fora de uma corrotina valem por thread.
+#define CORO_LOCAL_IO 0      // IoConn da sessao (io_backend)
+#define CORO_LOCAL_TRACE 1   // Buffer de rastreamento (trace)
+#define CORO_LOCAL_SESSION 2 // Session (battleserver)
+#define CORO_LOCALS 3
+
+typedef struct Coro Coro;
+typedef struct CoroWaiter CoroWaiter;
+
+// Condicao para corrotinas, sempre usada com um pthread_mutex travado (como pthread_cond_t)
+typedef struct {
+    CoroWaiter *head;
+    CoroWaiter *tail;
+} CoroCond;
+
+#define CORO_COND_INITIALIZER { NULL, NULL }
+
+static inline void coro_cond_init(CoroCond *cond) {
+    cond->head = NULL;
+    cond->tail = NULL;
+}
+
+// Cria as threads trabalhadoras (workers <= 0: uma por CPU) e a de eventos.
+// Retorna quantas trabalhadoras foram criadas ou -1.
+int coro_init(int workers);
+
+// Cria uma corrotina que executa fn(arg) e a coloca na fila de prontas. Ao retornar de fn a
+// corrotina termina e a pilha volta ao pool. Retorna NULL sem memoria.
+Coro *coro_spawn(void *(*fn)(void *), void *arg);
+
+// Corrotina atual (NULL fora de corrotinas) e seu identificador (0 fora de corrotinas)
+Coro *coro_self(void);
+int coro_id(void);
+
+// Descritor vigiado pela corrotina atual (um por corrotina): eventos de leitura ou
+// desconexao acordam coro_wait_io e as esperas de condicao com watch_io.
+int coro_watch(int fd);
+void coro_unwatch(void);
+
+// Como coro_watch, mas sem descritor: os eventos vem de outra thread por coro_notify_io
+// (usado pelo anel io_uring de recepcao, que e esperado pela thread dele e nao pelo epoll).
+void coro_watch_notify(void);
+void coro_notify_io(Coro *coro); // Pode ser chamada de qualquer thread
+
+// Suspende ate haver evento no descritor vigiado desde a ultima espera. Retorna 0, ou -1 se
+// a corrotina foi interrompida por coro_interrupt.
+int coro_wait_io(void);
+
+// Solta o mutex, suspende ate um coro_cond_broadcast (ou, com watch_io, ate um evento no
+// descritor vigiado ou coro_interrupt) e retrava o mutex. Retorna 1 se acordou por evento
+// ou interrupcao, 0 caso contrario. Pode acordar sem motivo: o chamador confere a condicao.
+int coro_cond_wait(CoroCond *cond, pthread_mutex_t *mutex, int watch_io);
+void coro_cond_broadcast(CoroCond *cond); // Com o mutex travado; pode ser chamada de qualquer thread
+
+// Faz a espera atual (ou a proxima) de coro_wait_io/coro_cond_wait com watch_io retornar
+// como interrompida. Usada para parar as sessoes na troca de processo.
+void coro_interrupt(Coro *coro);
+
+void *coro_local(int slot);
+void coro_set_local(int slot, void *value);
+
+// Syscalls de epoll feitas ate agora (espera da thread de eventos, coro_watch/coro_unwatch);
+// somadas por io_syscall_count
+unsigned long coro_syscall_count(void);
+
+#endif // CORO_H
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+
+static int fill_address(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "handoff: caminho longo demais: %s\n", path);
+        return -1;
+    }
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+    return 0;
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) < 0) return -1;
+
+    // SEQPACKET preserva os limites das mensagens: cada uma chega inteira, com seus fds
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("handoff: socket");
+        return -1;
+    }
+    unlink(path); // Sobra de um processo que nao terminou normalmente
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        perror("handoff: bind/listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (fill_address(&addr, path) < 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("handoff: socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        handoff_send(fd, HANDOFF_HELLO, NULL, 0, NULL, 0) < 0) {
+        perror("handoff: connect");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_send(int fd, uint32_t type, const void *payload, size_t len, const int *fds, int nfds) {
+    HandoffHeader hdr = { HANDOFF_MAGIC, HANDOFF_VERSION, type, (uint32_t)nfds };
+    struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { (void *)payload, len } };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+
+    if (nfds > 0) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS; // O processo que recebe ganha descritores para os mesmos sockets
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)(sizeof(hdr) + len) ? 0 : -1;
+}
+
+ssize_t handoff_recv(int fd, uint32_t *type, void *payload, size_t cap, int fds[HANDOFF_MAX_FDS], int *nfds) {
+    HandoffHeader hdr;
+    struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { payload, cap } };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = cap > 0 ? 2 : 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    *nfds = 0;
+    ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (n < (ssize_t)sizeof(hdr)) return -1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < count && *nfds < HANDOFF_MAX_FDS; i++) {
+            memcpy(&fds[(*nfds)++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        }
+    }
+
+    if (hdr.magic != HANDOFF_MAGIC || hdr.version != HANDOFF_VERSION || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+        hdr.nfds != (uint32_t)*nfds) {
+        fprintf(stderr, "handoff: mensagem invalida (versao %u, esperada %u).\n", hdr.version, HANDOFF_VERSION);
+        for (int i = 0; i < *nfds; i++) close(fds[i]);
+        *nfds = 0;
+        return -1;
+    }
+    *type = hdr.type;
+    return n - (ssize_t)sizeof(hdr);
+}
@@ -0,0 +1,89 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../common/protocol.h"
+#include "lobby.h"
+
+// Troca de processo sem derrubar partidas (--handoff / --takeover).
+// O processo novo conecta no socket de controle (AF_UNIX, SOCK_SEQPACKET) do processo atual
+// e recebe, nesta ordem: o listener TCP (e ja passa a aceitar com ele), uma mensagem por
+// conexao ou partida em andamento, com os sockets dos jogadores anexados via SCM_RIGHTS, e
+// HANDOFF_END. Ele responde HANDOFF_ACK depois de retomar tudo; so entao o processo antigo
+// termina. Sem o ACK, o processo antigo volta a atender as proprias conexoes.
+
+#define HANDOFF_MAGIC 0x42534831u // "BSH1"
+#define HANDOFF_VERSION 3         // Mudou algum struct abaixo: incrementar
+#define HANDOFF_MAX_FDS 2         // Um socket por jogador da partida
+#define HANDOFF_PLAYERS 2         // Jogadores por partida (PLAYERS_PER_MATCH)
+
+// Tipos de mensagem
+#define HANDOFF_HELLO 1    // novo -> atual: sem payload, confere magic/versao
+#define HANDOFF_LISTENER 2 // atual -> novo: fd do listener TCP
+#define HANDOFF_CLIENT 3   // atual -> novo: conexao que ainda nao entrou em partida (HandoffClient)
+#define HANDOFF_MATCH 4    // atual -> novo: partida com os sockets dos jogadores conectados (HandoffMatch)
+#define HANDOFF_END 5      // atual -> novo: fim da transferencia
+#define HANDOFF_ACK 6      // novo -> atual: tudo retomado, o processo atual pode sair
+
+// Ponto em que a thread da conexao retoma o atendimento no processo novo
+#define HANDOFF_PHASE_JOIN 0       // Esperando o JOIN (mensagem de boas-vindas ja enviada)
+#define HANDOFF_PHASE_PLACEMENT 1  // Posicionando navios
+#define HANDOFF_PHASE_WAIT_READY 2 // READY enviado, esperando o adversario (INICIO ainda nao enviado)
+#define HANDOFF_PHASE_PLAYING 3    // Partida em andamento
+#define HANDOFF_PHASE_REMATCH 4    // Partida com vencedor terminada (END enviado), esperando REMATCH
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type;
+    uint32_t nfds;
+} HandoffHeader;
+
+// Conexao: fase e bytes que o processo atual ja tinha lido do socket sem processar
+typedef struct {
+    int32_t phase;
+    uint32_t carry_len;
+    char carry[MAX_MSG];
+} HandoffClient;
+
+typedef struct {
+    int32_t connected; // 1 se o socket do jogador segue anexado a mensagem
+    HandoffClient client;
+    char name[NAME_MAX_LEN];
+    char board[BOARD_SIZE][BOARD_SIZE];
+    int32_t ships[MAX_SHIPS][6];
+    int32_t num_ships_placed;
+    int32_t ships_sunk;
+    int32_t ready;
+    int32_t pos_submarino;
+    int32_t pos_fragata;
+    int32_t pos_destroyer;
+} HandoffPlayer;
+
+typedef struct {
+    char room[ROOM_NAME_LEN];
+    int32_t num_players;
+    int32_t current_player_turn;
+    int32_t game_started;
+    int32_t game_over;
+    int32_t turn_count;
+    int32_t rematch; // Pedidos de revanche (bits por jogador e REMATCH_CANCELLED)
+    uint64_t started_ms; // Inicio do jogo (para --results)
+    uint8_t sunk_order[HANDOFF_PLAYERS * MAX_SHIPS]; // Navios afundados em ordem (para --results)
+    HandoffPlayer players[HANDOFF_PLAYERS]; // Sockets anexados na ordem dos jogadores conectados
+} HandoffMatch;
+
+// Socket de controle do processo atual (remove um arquivo antigo no mesmo caminho)
+int handoff_listen(const char *path);
+// Processo novo: conecta e envia HANDOFF_HELLO
+int handoff_connect(const char *path);
+
+// Envia uma mensagem com payload e fds anexados. Retorna 0 ou -1.
+int handoff_send(int fd, uint32_t type, const void *payload, size_t len, const int *fds, int nfds);
+// Recebe uma mensagem: preenche type, payload (ate cap bytes) e fds. Retorna o tamanho do
+// payload ou -1 (erro, conexao fechada ou magic/versao diferentes).
+ssize_t handoff_recv(int fd, uint32_t *type, void *payload, size_t cap, int fds[HANDOFF_MAX_FDS], int *nfds);
+
+#endif // HANDOFF_H
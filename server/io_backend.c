@@ -0,0 +1,1061 @@
+#define _GNU_SOURCE // accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "../common/protocol.h"
+#include "io_backend.h"
+#include "coro.h"
+
+// Identificadores das requisicoes no campo user_data. No anel de recepcao o recv leva
+// tambem o endereco da conexao (alinhado, entao os bits de TAG_MASK ficam livres).
+#define TAG_ACCEPT 1
+#define TAG_RECV 2
+#define TAG_SEND 3
+#define TAG_WATCH 4  // Poll do descritor vigiado junto com o listener
+#define TAG_CANCEL 5 // Cancelamento de um accept/recv multishot
+#define TAG_MASK 7
+
+#define RECV_BUF_GROUP 0 // Grupo do buffer ring (um so, no anel de recepcao)
+
+typedef struct IoRing IoRing;
+
+// Anel io_uring com o mapeamento das filas de submissao/conclusao. Ha um para o accept, um
+// para o recv de todas as conexoes e um por trabalhadora para os lotes de envio.
+struct IoRing {
+    int ring_fd;
+
+    // Fila de submissao (SQ)
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_pending; // SQEs preenchidas e ainda nao submetidas
+
+    // Fila de conclusao (CQ)
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+
+    // Buffer ring para o recv multishot (so no anel de recepcao)
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    char *recv_bufs;
+    unsigned short br_tail;
+};
+
+// Estado io_uring de uma conexao. A thread do anel de recepcao copia o que o recv multishot
+// entregou para in, devolve o buffer ao grupo compartilhado e acorda a corrotina: um cliente
+// que nao le nao prende buffers das outras conexoes.
+struct IoUringConn {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // io_conn_detach espera o recv terminar
+    int fd;
+    Coro *coro;  // Acordada a cada conclusao; NULL depois de io_conn_close
+    int armed;   // Recv multishot ativo no kernel
+    int cancel;  // Cancelamento pedido: o recv nao e rearmado
+    int closing; // io_conn_close ja saiu: a thread do anel libera na ultima conclusao
+    int status;  // 0, 1 se o cliente fechou, ou -errno
+    char *in;    // Recebido e ainda nao entregue por io_recv
+    size_t in_len;
+    size_t in_cap;
+
+    // Lote de envio
+    int batching;
+    int batch_count;
+    int batch_fd[IO_BATCH_MAX];
+    size_t batch_len[IO_BATCH_MAX];
+    char batch_msg[IO_BATCH_MAX][MAX_MSG];
+};
+
+IoBackendKind io_backend = IO_BACKEND_BLOCKING;
+
+static IoRing *accept_ring = NULL;
+static IoRing *recv_ring = NULL; // Consumido so pela thread de recepcao
+static pthread_mutex_t recv_sq_mutex = PTHREAD_MUTEX_INITIALIZER; // Submissoes no anel de recepcao
+static pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;
+static IoRing **send_rings = NULL; // Aneis de envio livres, um por trabalhadora
+static int send_free = 0;
+static int watch_fd = -1;   // Descritor vigiado por io_accept_batch (-1 = nenhum)
+static int watch_armed = 0; // Poll do descritor vigiado pendente no anel de accept
+static unsigned long io_syscalls = 0;
+
+void io_count_syscall(void) {
+    __atomic_add_fetch(&io_syscalls, 1, __ATOMIC_RELAXED);
+}
+
+unsigned long io_syscall_count(void) {
+    return __atomic_load_n(&io_syscalls, __ATOMIC_RELAXED) + coro_syscall_count();
+}
+
+const char *io_backend_name(IoBackendKind kind) {
+    return kind == IO_BACKEND_URING ? "io_uring" : "bloqueante";
+}
+
+// --- Primitivas do io_uring (sem liburing) ---
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    io_count_syscall();
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    io_count_syscall();
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    io_count_syscall();
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void ring_free(IoRing *ring) {
+    if (ring->br) munmap(ring->br, ring->br_size);
+    free(ring->recv_bufs);
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr && ring->cq_ptr != ring->sq_ptr) munmap(ring->cq_ptr, ring->cq_size);
+    if (ring->sq_ptr) munmap(ring->sq_ptr, ring->sq_size);
+    if (ring->ring_fd >= 0) close(ring->ring_fd);
+    free(ring);
+}
+
+static IoRing *ring_create(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    IoRing *ring = calloc(1, sizeof(IoRing));
+    if (!ring) return NULL;
+
+    ring->ring_fd = sys_io_uring_setup(entries, &p);
+    if (ring->ring_fd < 0) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size) ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        ring_free(ring);
+        return NULL;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            ring_free(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        ring_free(ring);
+        return NULL;
+    }
+
+    char *sq = ring->sq_ptr;
+    char *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return ring;
+}
+
+// Submete as SQEs pendentes e, opcionalmente, espera por wait_nr conclusoes
+static int ring_submit(IoRing *ring, unsigned wait_nr) {
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    int ret;
+    do {
+        ret = sys_io_uring_enter(ring->ring_fd, ring->sq_pending, wait_nr, flags);
+    } while (ret < 0 && errno == EINTR);
+    if (ret >= 0) ring->sq_pending -= (unsigned)ret < ring->sq_pending ? (unsigned)ret : ring->sq_pending;
+    return ret;
+}
+
+static struct io_uring_sqe *ring_get_sqe(IoRing *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    if (tail - head > *ring->sq_mask) { // Fila cheia: submete o que ja existe
+        ring_submit(ring, 0);
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head > *ring->sq_mask) return NULL;
+    }
+    unsigned idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->sq_pending++;
+    return sqe;
+}
+
+// Retira uma conclusao da CQ, se houver. Retorna 1 se encontrou.
+static int ring_pop_cqe(IoRing *ring, struct io_uring_cqe *out) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    *out = ring->cqes[head & *ring->cq_mask];
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// --- Buffer ring (buffers fornecidos ao kernel para o recv multishot) ---
+
+static void buf_ring_recycle(IoRing *ring, int bid) {
+    struct io_uring_buf *buf = &ring->br->bufs[ring->br_tail & (IO_RECV_BUFS - 1)];
+    buf->addr = (unsigned long)(ring->recv_bufs + (size_t)bid * MAX_MSG);
+    buf->len = MAX_MSG;
+    buf->bid = (unsigned short)bid;
+    ring->br_tail++;
+    __atomic_store_n(&ring->br->tail, ring->br_tail, __ATOMIC_RELEASE);
+}
+
+static int buf_ring_setup(IoRing *ring) {
+    ring->br_size = IO_RECV_BUFS * sizeof(struct io_uring_buf);
+    ring->br = mmap(NULL, ring->br_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring->br == MAP_FAILED) {
+        ring->br = NULL;
+        return -1;
+    }
+    ring->recv_bufs = malloc((size_t)IO_RECV_BUFS * MAX_MSG);
+    if (!ring->recv_bufs) return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->br;
+    reg.ring_entries = IO_RECV_BUFS;
+    reg.bgid = RECV_BUF_GROUP;
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -1;
+
+    ring->br_tail = 0;
+    for (int i = 0; i < IO_RECV_BUFS; i++) {
+        buf_ring_recycle(ring, i);
+    }
+    return 0;
+}
+
+
+// --- Selecao do backend ---
+
+// Recv multishot so existe a partir do 6.0 (o buffer ring e do 5.19): arma um em um par de
+// sockets e confere se ele entrega os dados
+static int recv_probe(IoRing *ring) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) return 0;
+    struct io_uring_sqe *sqe = ring_get_sqe(ring);
+    int ok = sqe != NULL;
+    if (sqe) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sv[0];
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RECV_BUF_GROUP;
+        sqe->user_data = TAG_RECV;
+        ok = ring_submit(ring, 0) >= 0 && send(sv[1], "x", 1, MSG_NOSIGNAL) == 1;
+    }
+    close(sv[1]); // O recv termina com 0 (fim da conexao) depois do byte
+    int last = !ok;
+    while (!last) {
+        struct io_uring_cqe cqe;
+        if (ring_submit(ring, 1) < 0) {
+            ok = 0;
+            break;
+        }
+        while (ring_pop_cqe(ring, &cqe)) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) buf_ring_recycle(ring, (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+            if (cqe.res < 0) ok = 0;
+            if (!(cqe.flags & IORING_CQE_F_MORE)) last = 1;
+        }
+    }
+    close(sv[0]);
+    return ok;
+}
+
+static void out_init(void);
+static void *recv_main(void *arg);
+
+IoBackendKind io_backend_init(IoBackendKind requested, int workers) {
+    io_backend = IO_BACKEND_BLOCKING;
+    out_init(); // Fila de saida dos clientes lentos (os dois backends)
+    if (requested != IO_BACKEND_URING) return io_backend;
+
+    IoRing *ring = ring_create(IO_RECV_ENTRIES);
+    if (!ring) {
+        printf("DEBUG: io_uring indisponivel neste kernel (%s). Usando backend bloqueante.\n", strerror(errno));
+        return io_backend;
+    }
+
+    // Verifica se o kernel conhece as operacoes que usamos
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    int ok = probe && sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    if (ok) {
+        int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND };
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) ok = 0;
+        }
+    }
+    free(probe);
+
+    // O anel que passou no teste vira o anel de recepcao de todas as conexoes
+    if (ok && (buf_ring_setup(ring) < 0 || !recv_probe(ring))) ok = 0;
+    pthread_t tid;
+    if (ok) {
+        recv_ring = ring;
+        if (pthread_create(&tid, NULL, recv_main, NULL) == 0) pthread_detach(tid);
+        else ok = 0;
+    }
+    if (!ok) {
+        recv_ring = NULL;
+        ring_free(ring);
+        printf("DEBUG: io_uring sem suporte a accept/recv multishot. Usando backend bloqueante.\n");
+        return io_backend;
+    }
+    // Um anel de envio por trabalhadora: um lote nunca suspende, entao nao ha mais lotes ao
+    // mesmo tempo do que trabalhadoras
+    send_rings = calloc((size_t)workers, sizeof(IoRing *));
+    for (int i = 0; send_rings && i < workers; i++) {
+        IoRing *send = ring_create(IO_URING_ENTRIES);
+        if (send) send_rings[send_free++] = send;
+    }
+    io_backend = IO_BACKEND_URING;
+    return io_backend;
+}
+
+// --- Accept ---
+
+static int accept_arm(int server_fd) {
+    struct io_uring_sqe *sqe = ring_get_sqe(accept_ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = TAG_ACCEPT;
+    return ring_submit(accept_ring, 0) < 0 ? -1 : 0;
+}
+
+// Poll de uma so vez no descritor vigiado; submetido junto com a proxima espera
+static void watch_arm(void) {
+    struct io_uring_sqe *sqe = ring_get_sqe(accept_ring);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = watch_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = TAG_WATCH;
+    watch_armed = 1;
+}
+
+void io_accept_watch(int fd) {
+    watch_fd = fd;
+    watch_armed = 0;
+}
+
+int io_accept_start(int server_fd) {
+    if (io_backend != IO_BACKEND_URING) {
+        // Listener nao bloqueante: cada despertar drena a fila ate EAGAIN
+        int flags = fcntl(server_fd, F_GETFL, 0);
+        return fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    // O listener pode vir de um processo no modo bloqueante (troca de processo): com O_NONBLOCK
+    // o accept do anel retornaria EAGAIN em vez de esperar
+    int flags = fcntl(server_fd, F_GETFL, 0);
+    fcntl(server_fd, F_SETFL, flags & ~O_NONBLOCK);
+    accept_ring = ring_create(IO_URING_ENTRIES);
+    if (!accept_ring || accept_arm(server_fd) < 0) {
+        printf("DEBUG: Falha ao armar accept multishot. Usando accept bloqueante.\n");
+        if (accept_ring) ring_free(accept_ring);
+        accept_ring = NULL;
+        return fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
+    }
+    return 0;
+}
+
+// Caminho bloqueante: poll ate o listener (ou o descritor vigiado) ficar pronto e accept4
+// ate esvaziar a fila
+static int accept_batch_blocking(int server_fd, IoAccepted *out, int max) {
+    struct pollfd pfd[2] = { { .fd = server_fd, .events = POLLIN }, { .fd = watch_fd, .events = POLLIN } };
+    io_count_syscall();
+    if (poll(pfd, watch_fd >= 0 ? 2 : 1, -1) < 0) return errno == EINTR ? 0 : -1;
+    if (!(pfd[0].revents & POLLIN)) return 0;
+
+    int count = 0;
+    while (count < max) {
+        socklen_t len = sizeof(out[count].addr);
+        io_count_syscall();
+        int fd = accept4(server_fd, (struct sockaddr *)&out[count].addr, &len, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return count > 0 ? count : -1;
+        }
+        out[count++].fd = fd;
+    }
+    return count;
+}
+
+static void accept_fill(IoAccepted *acc, int fd) {
+    // O accept multishot nao preenche o endereco do cliente
+    socklen_t len = sizeof(acc->addr);
+    acc->fd = fd;
+    memset(&acc->addr, 0, sizeof(acc->addr));
+    io_count_syscall();
+    getpeername(fd, (struct sockaddr *)&acc->addr, &len);
+}
+
+int io_accept_batch(int server_fd, IoAccepted *out, int max) {
+    if (!accept_ring) return accept_batch_blocking(server_fd, out, max);
+
+    struct io_uring_cqe cqe;
+    int count = 0;
+    int rearm = 0;
+    int watched = 0;
+    if (watch_fd >= 0 && !watch_armed) watch_arm();
+    while (count == 0 && !watched) {
+        // Drena todas as conclusoes disponiveis; so entra no kernel se nao houver nenhuma
+        while (count < max && ring_pop_cqe(accept_ring, &cqe)) {
+            if (cqe.user_data == TAG_WATCH) {
+                watch_armed = 0;
+                watched = 1;
+                continue;
+            }
+            // O accept multishot continua ativo enquanto IORING_CQE_F_MORE estiver marcado
+            if (!(cqe.flags & IORING_CQE_F_MORE)) rearm = 1;
+            if (cqe.res >= 0) accept_fill(&out[count++], cqe.res);
+        }
+        if (rearm) {
+            accept_arm(server_fd);
+            rearm = 0;
+        }
+        if (count == 0 && !watched && ring_submit(accept_ring, 1) < 0) return -1;
+    }
+    return count;
+}
+
+int io_accept_stop(int server_fd, IoAccepted *out, int max) {
+    (void)server_fd; // No modo bloqueante a fila de pendentes fica no kernel, com o listener
+    if (!accept_ring) return 0;
+
+    // Cancela o accept multishot e recolhe as conexoes que ele entregou antes de parar
+    int count = 0;
+    int done = 1;
+    struct io_uring_sqe *sqe = ring_get_sqe(accept_ring);
+    if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = TAG_ACCEPT;
+        sqe->user_data = TAG_CANCEL;
+        done = ring_submit(accept_ring, 0) < 0;
+    }
+    while (!done) {
+        struct io_uring_cqe cqe;
+        while (ring_pop_cqe(accept_ring, &cqe)) {
+            if (cqe.user_data == TAG_CANCEL && cqe.res == -ENOENT) {
+                done = 1; // Nenhum accept armado
+            } else if (cqe.user_data == TAG_ACCEPT) {
+                if (cqe.res >= 0) {
+                    if (count < max) accept_fill(&out[count++], cqe.res);
+                    else close(cqe.res);
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE)) done = 1;
+            }
+        }
+        if (!done && ring_submit(accept_ring, 1) < 0) break;
+    }
+    ring_free(accept_ring);
+    accept_ring = NULL;
+    watch_armed = 0;
+    return count;
+}
+
+
+// --- Recv ---
+
+// Arma o recv multishot da conexao no anel de recepcao (ou o cancela) e submete na hora.
+// Qualquer thread submete, com o lock da SQ; so a thread de recepcao consome a CQ.
+static int recv_ring_op(IoUringConn *u, int cancel) {
+    pthread_mutex_lock(&recv_sq_mutex);
+    struct io_uring_sqe *sqe = ring_get_sqe(recv_ring);
+    int ret = -1;
+    if (sqe) {
+        if (cancel) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = (uintptr_t)u | TAG_RECV;
+            sqe->user_data = TAG_CANCEL;
+        } else {
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = u->fd;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = RECV_BUF_GROUP;
+            sqe->user_data = (uintptr_t)u | TAG_RECV;
+        }
+        ret = ring_submit(recv_ring, 0) < 0 ? -1 : 0;
+    }
+    pthread_mutex_unlock(&recv_sq_mutex);
+    return ret;
+}
+
+static void uring_conn_free(IoUringConn *u) {
+    pthread_mutex_destroy(&u->mutex);
+    pthread_cond_destroy(&u->cond);
+    free(u->in);
+    free(u);
+}
+
+// Com o lock da conexao travado. Um cliente que envia sem a sessao ler perde a conexao, como
+// o que nao le o que o servidor envia (IO_OUT_MAX).
+static void in_append(IoUringConn *u, const char *data, size_t n) {
+    if (u->in_len + n > u->in_cap && u->in_len + n <= IO_IN_MAX) {
+        size_t cap = u->in_cap ? u->in_cap : MAX_MSG;
+        while (cap < u->in_len + n) cap *= 2;
+        if (cap > IO_IN_MAX) cap = IO_IN_MAX;
+        char *in = realloc(u->in, cap);
+        if (in) {
+            u->in = in;
+            u->in_cap = cap;
+        }
+    }
+    if (u->in_len + n > u->in_cap) {
+        if (u->status == 0) {
+            printf("DEBUG: Cliente (socket %d) enviou mais do que a sessao leu; conexao encerrada.\n", u->fd);
+            io_count_syscall();
+            shutdown(u->fd, SHUT_RDWR);
+        }
+        u->status = 1; // A sessao le o que ja chegou e depois ve a desconexao
+        return;
+    }
+    memcpy(u->in + u->in_len, data, n);
+    u->in_len += n;
+}
+
+static void recv_complete(IoUringConn *u, const struct io_uring_cqe *cqe) {
+    int freed = 0;
+    pthread_mutex_lock(&u->mutex);
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        int bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!u->closing) in_append(u, recv_ring->recv_bufs + (size_t)bid * MAX_MSG, (size_t)cqe->res);
+        buf_ring_recycle(recv_ring, bid); // So esta thread devolve buffers: sem lock do grupo
+    } else if (cqe->res == 0) {
+        u->status = 1; // Conexao encerrada pelo cliente
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED && u->status == 0) {
+        u->status = cqe->res;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        // Sem buffers livres (ENOBUFS) o kernel encerra o multishot: rearma se a conexao segue
+        int rearm = !u->cancel && !u->closing && u->status == 0;
+        if (rearm && recv_ring_op(u, 0) < 0) {
+            u->status = -EIO;
+            rearm = 0;
+        }
+        if (!rearm) {
+            u->armed = 0;
+            pthread_cond_broadcast(&u->cond);
+            freed = u->closing;
+        }
+    }
+    if (u->coro) coro_notify_io(u->coro);
+    pthread_mutex_unlock(&u->mutex);
+    if (freed) uring_conn_free(u);
+}
+
+// Thread de recepcao: cada despertar trata todas as conclusoes prontas, de todas as conexoes
+static void *recv_main(void *arg) {
+    (void)arg;
+    while (1) {
+        if (sys_io_uring_enter(recv_ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            perror("io_uring: espera do anel de recepcao");
+            return NULL;
+        }
+        struct io_uring_cqe cqe;
+        while (ring_pop_cqe(recv_ring, &cqe)) {
+            if ((cqe.user_data & TAG_MASK) == TAG_RECV) {
+                recv_complete((IoUringConn *)(uintptr_t)(cqe.user_data & ~(uint64_t)TAG_MASK), &cqe);
+            }
+        }
+    }
+    return NULL;
+}
+
+void io_conn_open(IoConn *conn, int fd) {
+    conn->fd = fd;
+    conn->uring = NULL;
+    conn->carry = NULL;
+    conn->carry_len = 0;
+    conn->readable = 1;
+    IoUringConn *u = io_backend == IO_BACKEND_URING ? calloc(1, sizeof(IoUringConn)) : NULL;
+    if (!u) {
+        coro_watch(fd); // A corrotina espera pelo socket
+        return;
+    }
+    pthread_mutex_init(&u->mutex, NULL);
+    pthread_cond_init(&u->cond, NULL);
+    u->fd = fd;
+    u->coro = coro_self();
+    u->armed = 1;
+    coro_watch_notify(); // Acordada pela thread de recepcao
+    // O recv e submetido ja: a sessao pode ir direto esperar a vez e precisa saber de
+    // uma desconexao sem ter passado por io_recv
+    if (recv_ring_op(u, 0) < 0) {
+        u->armed = 0;
+        u->status = -EIO;
+    }
+    conn->uring = u;
+}
+
+void io_conn_close(IoConn *conn) {
+    if (coro_local(CORO_LOCAL_IO) == conn) coro_set_local(CORO_LOCAL_IO, NULL);
+    coro_unwatch();
+    IoUringConn *u = conn->uring;
+    if (!u) return;
+    conn->uring = NULL;
+    pthread_mutex_lock(&u->mutex);
+    u->coro = NULL;
+    int armed = u->armed;
+    if (armed) {
+        // A ultima conclusao do recv ainda vai chegar: quem libera e a thread de recepcao
+        u->closing = 1;
+        if (!u->cancel) {
+            u->cancel = 1;
+            recv_ring_op(u, 1);
+        }
+    }
+    pthread_mutex_unlock(&u->mutex);
+    if (!armed) uring_conn_free(u);
+}
+
+void io_conn_preload(IoConn *conn, const char *data, size_t len) {
+    conn->carry = data;
+    conn->carry_len = len;
+}
+
+// Acrescenta n bytes a out (com len bytes ja usados); o que nao couber e descartado
+static size_t carry_append(char *out, size_t len, size_t cap, const char *src, size_t n) {
+    if (n > cap - len) {
+        printf("DEBUG: Troca de processo: %zu bytes pendentes descartados (limite %zu).\n", n - (cap - len), cap);
+        n = cap - len;
+    }
+    memmove(out + len, src, n); // src pode ser o proprio out (carry herdado e transferido de novo)
+    return len + n;
+}
+
+size_t io_conn_detach(IoConn *conn, char *out, size_t cap) {
+    IoUringConn *u = conn->uring;
+    size_t len = 0;
+    if (conn->carry_len > 0) len = carry_append(out, len, cap, conn->carry, conn->carry_len);
+
+    if (u) {
+        // O recv multishot ja pode ter lido dados que o jogador enviou: eles seguem a conexao.
+        // Cancela o recv e espera a conclusao final, que a thread de recepcao sinaliza.
+        pthread_mutex_lock(&u->mutex);
+        if (u->armed && !u->cancel) {
+            u->cancel = 1;
+            if (recv_ring_op(u, 1) == 0) {
+                while (u->armed) pthread_cond_wait(&u->cond, &u->mutex);
+            }
+        }
+        len = carry_append(out, len, cap, u->in, u->in_len);
+        u->in_len = 0;
+        pthread_mutex_unlock(&u->mutex);
+    }
+    io_conn_close(conn);
+    return len;
+}
+
+void io_set_thread_conn(IoConn *conn) {
+    coro_set_local(CORO_LOCAL_IO, conn);
+}
+
+static IoUringConn *thread_uring(void) {
+    IoConn *conn = coro_local(CORO_LOCAL_IO);
+    return conn ? conn->uring : NULL;
+}
+
+// Fora de linha: errno e por thread e so pode ser lido na mesma funcao que fez a syscall,
+// nunca depois de uma espera (a corrotina pode ter voltado em outra trabalhadora)
+static __attribute__((noinline)) int would_block(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Recv sem bloquear a trabalhadora: sem dados, a corrotina espera o evento do socket.
+// readable evita um recv inutil (EAGAIN) antes de cada espera.
+static ssize_t socket_recv(IoConn *conn, char *buf, size_t len) {
+    while (1) {
+        if (!conn->readable && coro_wait_io() < 0) return IO_RECV_INTERRUPTED;
+        conn->readable = 1;
+        io_count_syscall();
+        ssize_t n = recv(conn->fd, buf, len, MSG_DONTWAIT);
+        if (n >= 0 || !would_block()) return n;
+        conn->readable = 0;
+    }
+}
+
+ssize_t io_recv(IoConn *conn, char *buf, size_t len) {
+    if (conn->carry_len > 0) {
+        size_t n = conn->carry_len < len ? conn->carry_len : len;
+        memcpy(buf, conn->carry, n);
+        conn->carry += n;
+        conn->carry_len -= n;
+        return (ssize_t)n;
+    }
+
+    IoUringConn *u = conn->uring;
+    if (!u) return socket_recv(conn, buf, len);
+
+    // Sem dados, a corrotina espera a thread de recepcao: ela marca o evento antes de acordar,
+    // entao o que chegar entre a conferencia e a espera nao se perde
+    while (1) {
+        pthread_mutex_lock(&u->mutex);
+        if (u->in_len > 0) {
+            size_t n = u->in_len < len ? u->in_len : len;
+            memcpy(buf, u->in, n);
+            memmove(u->in, u->in + n, u->in_len - n);
+            u->in_len -= n;
+            pthread_mutex_unlock(&u->mutex);
+            return (ssize_t)n;
+        }
+        int status = u->status;
+        pthread_mutex_unlock(&u->mutex);
+        if (status == 1) return 0; // Conexao encerrada pelo cliente
+        if (status < 0) {
+            errno = -status;
+            return -1;
+        }
+        if (coro_wait_io() < 0) return IO_RECV_INTERRUPTED;
+    }
+}
+
+// Com io_uring os bytes ja estao na entrada da conexao: io_peek so copia. Um erro fica para
+// io_recv trata-lo.
+ssize_t io_peek(IoConn *conn, char *buf, size_t len) {
+    if (conn->carry_len > 0) {
+        size_t n = conn->carry_len < len ? conn->carry_len : len;
+        memcpy(buf, conn->carry, n);
+        return (ssize_t)n;
+    }
+
+    IoUringConn *u = conn->uring;
+    if (!u) {
+        io_count_syscall();
+        ssize_t n = recv(conn->fd, buf, len, MSG_PEEK | MSG_DONTWAIT);
+        if (n >= 0) {
+            conn->readable = 1; // O evento do socket ja foi consumido pela espera de quem chamou
+            return n;
+        }
+        if (!would_block()) return -1;
+        conn->readable = 0;
+        return IO_RECV_EMPTY;
+    }
+
+    pthread_mutex_lock(&u->mutex);
+    ssize_t n = IO_RECV_EMPTY;
+    if (u->in_len > 0) {
+        n = (ssize_t)(u->in_len < len ? u->in_len : len);
+        memcpy(buf, u->in, (size_t)n);
+    } else if (u->status == 1) {
+        n = 0;
+    }
+    pthread_mutex_unlock(&u->mutex);
+    return n;
+}
+
+// --- Send ---
+
+// Saida que nao coube no socket de um cliente. So existe para quem parou de ler, entao a
+// tabela e pequena: listas curtas em IO_OUT_STRIPES entradas, cada uma com o seu lock.
+typedef struct OutQueue {
+    int fd;
+    size_t len;
+    struct OutQueue *next;
+    char data[IO_OUT_MAX];
+} OutQueue;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    OutQueue *head;
+} OutStripe;
+
+static OutStripe out_stripes[IO_OUT_STRIPES];
+static int out_epoll = -1; // EPOLLOUT dos descritores com fila, vigiado pela thread de saida
+
+static void *out_writer_main(void *arg);
+
+// Chamada uma vez, por io_backend_init
+static void out_init(void) {
+    for (int i = 0; i < IO_OUT_STRIPES; i++) pthread_mutex_init(&out_stripes[i].mutex, NULL);
+    out_epoll = epoll_create1(EPOLL_CLOEXEC);
+    pthread_t writer;
+    if (out_epoll < 0 || pthread_create(&writer, NULL, out_writer_main, NULL) != 0) {
+        perror("Erro ao criar a thread de saida");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(writer);
+}
+
+static OutStripe *out_stripe(int fd) {
+    return &out_stripes[(unsigned)fd % IO_OUT_STRIPES];
+}
+
+// Com o lock da entrada travado
+static OutQueue **out_find(OutStripe *stripe, int fd) {
+    OutQueue **pp = &stripe->head;
+    while (*pp && (*pp)->fd != fd) pp = &(*pp)->next;
+    return pp;
+}
+
+static void out_remove(OutQueue **pp) {
+    OutQueue *q = *pp;
+    *pp = q->next;
+    io_count_syscall();
+    epoll_ctl(out_epoll, EPOLL_CTL_DEL, q->fd, NULL);
+    free(q);
+}
+
+// Uma vez: cada EPOLLOUT acorda a thread de saida so para este descritor, ate ela rearmar
+static void out_arm(int fd, int op) {
+    struct epoll_event ev = { .events = EPOLLOUT | EPOLLONESHOT, .data.fd = fd };
+    io_count_syscall();
+    epoll_ctl(out_epoll, op, fd, &ev);
+}
+
+// Envio sem bloquear a trabalhadora. O socket cheio (cliente que parou de ler) nao segura a
+// sessao nem quem esta com o mutex da partida: o resto vai para a fila do descritor, e as
+// mensagens seguintes entram atras dele para manter a ordem. Com a fila cheia a conexao e
+// encerrada e a sessao dele ve a desconexao.
+static void send_now(int fd, const char *msg, size_t len) {
+    OutStripe *stripe = out_stripe(fd);
+    pthread_mutex_lock(&stripe->mutex);
+    OutQueue **pp = out_find(stripe, fd);
+    if (!*pp) {
+        io_count_syscall();
+        ssize_t n = send(fd, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if ((n < 0 && !would_block()) || (size_t)n == len) {
+            pthread_mutex_unlock(&stripe->mutex);
+            return; // Enviada, ou conexao ja encerrada (a sessao dele ve no recv)
+        }
+        if (n > 0) {
+            msg += n;
+            len -= (size_t)n;
+        }
+        OutQueue *q = malloc(sizeof(OutQueue));
+        if (q) {
+            q->fd = fd;
+            q->len = 0;
+            q->next = NULL;
+            *pp = q;
+            out_arm(fd, EPOLL_CTL_ADD);
+        }
+    }
+    OutQueue *q = *pp;
+    if (q && len <= IO_OUT_MAX - q->len) {
+        memcpy(q->data + q->len, msg, len);
+        q->len += len;
+    } else {
+        printf("DEBUG: Cliente (socket %d) nao esta lendo as mensagens; conexao encerrada.\n", fd);
+        if (q) out_remove(pp);
+        io_count_syscall();
+        shutdown(fd, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+}
+
+// Escreve o que couber da fila; com lock da entrada travado. Retorna 1 se ainda sobrou.
+static int out_write(OutQueue **pp) {
+    OutQueue *q = *pp;
+    io_count_syscall();
+    ssize_t n = send(q->fd, q->data, q->len, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+        memmove(q->data, q->data + n, q->len - (size_t)n);
+        q->len -= (size_t)n;
+    }
+    if (q->len == 0 || (n < 0 && !would_block())) {
+        out_remove(pp);
+        return 0;
+    }
+    return 1;
+}
+
+static void *out_writer_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[CORO_EPOLL_BATCH];
+    while (1) {
+        io_count_syscall();
+        int n = epoll_wait(out_epoll, events, CORO_EPOLL_BATCH, -1);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            OutStripe *stripe = &out_stripes[(unsigned)fd % IO_OUT_STRIPES];
+            pthread_mutex_lock(&stripe->mutex);
+            OutQueue **pp = out_find(stripe, fd);
+            if (*pp && out_write(pp)) out_arm(fd, EPOLL_CTL_MOD);
+            pthread_mutex_unlock(&stripe->mutex);
+        }
+    }
+    return NULL;
+}
+
+static int out_pending(int fd) {
+    OutStripe *stripe = out_stripe(fd);
+    pthread_mutex_lock(&stripe->mutex);
+    int pending = *out_find(stripe, fd) != NULL;
+    pthread_mutex_unlock(&stripe->mutex);
+    return pending;
+}
+
+void io_out_forget(int fd) {
+    OutStripe *stripe = out_stripe(fd);
+    pthread_mutex_lock(&stripe->mutex);
+    OutQueue **pp = out_find(stripe, fd);
+    if (*pp) out_remove(pp);
+    pthread_mutex_unlock(&stripe->mutex);
+}
+
+int io_out_drain(int timeout_ms) {
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int dropped = 0;
+    for (int i = 0; i < IO_OUT_STRIPES; i++) {
+        OutStripe *stripe = &out_stripes[i];
+        pthread_mutex_lock(&stripe->mutex);
+        while (stripe->head) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long left = timeout_ms - ((now.tv_sec - start.tv_sec) * 1000L + (now.tv_nsec - start.tv_nsec) / 1000000L);
+            struct pollfd pfd = { .fd = stripe->head->fd, .events = POLLOUT };
+            int ready = 0;
+            if (left > 0) {
+                io_count_syscall();
+                ready = poll(&pfd, 1, (int)left) > 0;
+            }
+            if (ready) {
+                out_write(&stripe->head); // A fila sai da lista quando esvazia
+                continue;
+            }
+            printf("DEBUG: Troca de processo: %zu bytes para o socket %d descartados.\n", stripe->head->len, stripe->head->fd);
+            out_remove(&stripe->head);
+            dropped++;
+        }
+        pthread_mutex_unlock(&stripe->mutex);
+    }
+    return dropped;
+}
+
+// Anel de envio para um lote; NULL se todos estiverem em uso (o lote sai por send_now)
+static IoRing *send_ring_get(void) {
+    pthread_mutex_lock(&send_mutex);
+    IoRing *ring = send_free > 0 ? send_rings[--send_free] : NULL;
+    pthread_mutex_unlock(&send_mutex);
+    return ring;
+}
+
+static void send_ring_put(IoRing *ring) {
+    pthread_mutex_lock(&send_mutex);
+    send_rings[send_free++] = ring;
+    pthread_mutex_unlock(&send_mutex);
+}
+
+void io_send(int fd, const char *msg, size_t len) {
+    IoUringConn *u = thread_uring();
+    if (u && u->batching && len <= MAX_MSG) {
+        if (u->batch_count == IO_BATCH_MAX) io_batch_flush();
+        u->batching = 1;
+        memcpy(u->batch_msg[u->batch_count], msg, len);
+        u->batch_fd[u->batch_count] = fd;
+        u->batch_len[u->batch_count] = len;
+        u->batch_count++;
+        return;
+    }
+    send_now(fd, msg, len);
+}
+
+void io_batch_begin(void) {
+    IoUringConn *u = thread_uring();
+    if (u) u->batching = 1;
+}
+
+void io_batch_flush(void) {
+    IoUringConn *u = thread_uring();
+    if (!u) return;
+    u->batching = 0;
+    if (u->batch_count == 0) return;
+
+    // Um destinatario com saida pendente recebe tudo pela fila, na ordem
+    IoRing *ring = send_ring_get();
+    int queued = 0;
+    int direct = ring != NULL;
+    for (int i = 0; i < u->batch_count && direct; i++) direct = !out_pending(u->batch_fd[i]);
+
+    // Envios encadeados (IOSQE_IO_LINK) para preservar a ordem das mensagens
+    for (int i = 0; i < u->batch_count && direct; i++) {
+        struct io_uring_sqe *sqe = ring_get_sqe(ring);
+        if (!sqe) break;
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = u->batch_fd[i];
+        sqe->addr = (unsigned long)u->batch_msg[i];
+        sqe->len = (unsigned)u->batch_len[i];
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT; // Socket cheio: -EAGAIN, segue por send_now
+        sqe->user_data = ((unsigned long long)i << 8) | TAG_SEND;
+        if (i + 1 < u->batch_count) sqe->flags = IOSQE_IO_LINK;
+        queued++;
+    }
+
+    // O anel e so deste lote ate send_ring_put: toda conclusao e de uma mensagem dele
+    int remaining = queued;
+    size_t sent[IO_BATCH_MAX] = {0}; // Bytes que ja sairam de cada mensagem
+    if (queued > 0 && ring_submit(ring, (unsigned)remaining) < 0) remaining = 0;
+    while (remaining > 0) {
+        struct io_uring_cqe cqe;
+        while (remaining > 0 && ring_pop_cqe(ring, &cqe)) {
+            int i = (int)(cqe.user_data >> 8);
+            if (cqe.res >= 0) sent[i] = (size_t)cqe.res;
+            else if (cqe.res != -ECANCELED && cqe.res != -EAGAIN) sent[i] = u->batch_len[i]; // Conexao encerrada
+            remaining--;
+        }
+        if (remaining > 0 && ring_submit(ring, 1) < 0) break;
+    }
+    if (remaining > 0) ring_free(ring); // Conclusoes atrasadas confundiriam o proximo lote
+    else if (ring) send_ring_put(ring);
+
+    // Mensagens cuja cadeia foi quebrada, que sairam pela metade ou que nao couberam na SQ
+    // seguem pelo caminho simples
+    for (int i = 0; i < u->batch_count; i++) {
+        if (i >= queued || sent[i] < u->batch_len[i]) {
+            size_t from = i < queued ? sent[i] : 0;
+            send_now(u->batch_fd[i], u->batch_msg[i] + from, u->batch_len[i] - from);
+        }
+    }
+    u->batch_count = 0;
+}
@@ -0,0 +1,113 @@
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+// Backend de I/O usado pelo servidor para accept/recv/send.
+// - IO_BACKEND_BLOCKING: chamadas bloqueantes tradicionais (uma syscall por operacao)
+// - IO_BACKEND_URING: io_uring com accept multishot, recv multishot de todas as conexoes em
+//   um anel so (com um grupo de buffers compartilhado) e envio em lote das mensagens de turno
+//   pelo anel da trabalhadora (uma syscall por lote)
+typedef enum {
+    IO_BACKEND_BLOCKING = 0,
+    IO_BACKEND_URING = 1
+} IoBackendKind;
+
+#define IO_URING_ENTRIES 32   // Fila de submissao dos aneis de accept e de envio (um por trabalhadora)
+#define IO_RECV_ENTRIES 1024  // Fila de submissao do anel de recepcao, compartilhado pelas conexoes
+#define IO_RECV_BUFS 1024     // Buffers do grupo compartilhado pelo recv multishot (potencia de 2)
+#define IO_BATCH_MAX 16       // Maximo de mensagens acumuladas em um lote de envio
+#define IO_IN_MAX (16 * 1024)  // Entrada recebida e ainda nao lida pela sessao; acima disso a conexao cai
+#define IO_OUT_MAX (16 * 1024) // Saida pendente por cliente que nao le; acima disso a conexao cai
+#define IO_OUT_STRIPES 64      // Locks da tabela de saidas pendentes (por descritor)
+
+typedef struct IoUringConn IoUringConn;
+
+// Conexao recem-aceita
+typedef struct {
+    int fd;
+    struct sockaddr_in addr; // Endereco do cliente
+} IoAccepted;
+
+// Estado de I/O de uma conexao (uma por sessao de jogador)
+typedef struct {
+    int fd;
+    IoUringConn *uring; // NULL quando a conexao usa o caminho bloqueante
+    const char *carry; // Bytes herdados de outro processo, entregues antes dos do socket
+    size_t carry_len;
+    int readable; // 0 depois de um recv com EAGAIN, ate o proximo evento do socket
+} IoConn;
+
+#define IO_RECV_INTERRUPTED (-2) // io_recv: espera interrompida por coro_interrupt
+#define IO_RECV_EMPTY (-3)       // io_peek: nada chegou ainda
+
+extern IoBackendKind io_backend;
+
+// Seleciona o backend na inicializacao. Se io_uring for pedido mas o kernel nao
+// suportar as operacoes necessarias (recv multishot, kernel >= 6.0), cai para o backend
+// bloqueante. Com io_uring, uma thread propria espera o anel de recepcao e acorda as sessoes,
+// e cada uma das workers trabalhadoras tem um anel para os lotes de envio.
+IoBackendKind io_backend_init(IoBackendKind requested, int workers);
+const char *io_backend_name(IoBackendKind kind);
+
+// Accept: io_accept_start prepara o listener (accept multishot no io_uring, socket nao
+// bloqueante no modo bloqueante). io_accept_batch espera ate haver conexoes e drena ate
+// max delas de uma vez; retorna quantas foram aceitas ou -1 em erro.
+int io_accept_start(int server_fd);
+int io_accept_batch(int server_fd, IoAccepted *out, int max);
+
+// Descritor extra vigiado junto com o listener: quando ele fica legivel, io_accept_batch
+// retorna (possivelmente com 0 conexoes) para o chamador trata-lo.
+void io_accept_watch(int fd);
+
+// Para de aceitar no listener (o listener continua aberto). Conexoes que o kernel ja tinha
+// entregue ao anel sao devolvidas em out; retorna quantas.
+int io_accept_stop(int server_fd, IoAccepted *out, int max);
+
+// Conexoes de jogador, sempre usadas dentro da corrotina da sessao: io_conn_open vigia o
+// socket (ou arma o recv no anel de recepcao) e io_recv, sem dados, suspende so a corrotina. io_recv retorna
+// IO_RECV_INTERRUPTED se a espera for interrompida (troca de processo).
+void io_conn_open(IoConn *conn, int fd);
+ssize_t io_recv(IoConn *conn, char *buf, size_t len);
+void io_conn_close(IoConn *conn);
+
+// Copia para buf o que o cliente ja enviou sem consumir (o proximo io_recv entrega os mesmos
+// bytes) e sem esperar. Retorna quantos bytes, 0 se o cliente fechou ou IO_RECV_EMPTY.
+ssize_t io_peek(IoConn *conn, char *buf, size_t len);
+
+// Troca de processo: io_conn_detach fecha o estado de I/O sem tocar no socket e copia para
+// out os bytes ja lidos do socket e ainda nao entregues por io_recv (retorna quantos).
+// io_conn_preload faz io_recv entregar data antes do que vier do socket (data deve
+// continuar valido enquanto a conexao estiver aberta).
+size_t io_conn_detach(IoConn *conn, char *out, size_t cap);
+void io_conn_preload(IoConn *conn, const char *data, size_t len);
+
+// Envio. Dentro de io_batch_begin/io_batch_flush as mensagens da sessao atual sao
+// acumuladas e submetidas juntas; fora de um lote, io_send envia imediatamente. Nenhum envio
+// bloqueia: o que nao cabe no socket fica em uma fila do descritor, escrita por uma thread
+// propria quando o cliente volta a ler (IO_OUT_MAX bytes no maximo, depois a conexao cai).
+void io_send(int fd, const char *msg, size_t len);
+void io_batch_begin(void);
+void io_batch_flush(void);
+
+// Descarta a saida pendente do descritor. Obrigatorio antes de fechar um socket de jogador:
+// o numero pode ir para outra conexao.
+void io_out_forget(int fd);
+
+// Troca de processo: escreve as saidas pendentes esperando no maximo timeout_ms (o que sobrar
+// e descartado). Retorna quantos descritores ficaram com saida descartada.
+int io_out_drain(int timeout_ms);
+
+// Conexao da sessao atual (usada por io_send para saber em qual lote acumular)
+void io_set_thread_conn(IoConn *conn);
+
+// Estatisticas de syscalls de I/O para comparar os backends: todas as do caminho dos sockets
+// de jogador, inclusive as esperas (epoll da thread de eventos e da thread de saida, anel de
+// recepcao). io_count_syscall conta as que o servidor faz direto no socket (poll, shutdown,
+// close).
+unsigned long io_syscall_count(void);
+void io_count_syscall(void);
+
+#endif // IO_BACKEND_H
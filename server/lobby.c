@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "lobby.h"
+
+// Entrada de um indice (nome online ou sala aberta)
+typedef struct LobbyNode {
+    char key[NAME_MAX_LEN];
+    struct Match *match;      // Partida aberta (so no indice de salas)
+    struct LobbyNode *next;
+} LobbyNode;
+
+typedef struct {
+    LobbyNode **buckets;
+    pthread_mutex_t stripes[LOBBY_STRIPES];
+} LobbyIndex;
+
+// Fila publica (FIFO) de partidas esperando o segundo jogador
+typedef struct PublicEntry {
+    struct Match *match;
+    struct PublicEntry *next;
+} PublicEntry;
+
+// Texto internado: alocado no tamanho exato, compartilhado por todas as partidas que o usam
+typedef struct InternNode {
+    struct InternNode *next;
+    unsigned refs;
+    char text[];
+} InternNode;
+
+static LobbyIndex names;
+static LobbyIndex rooms;
+static InternNode **interned;
+static pthread_mutex_t intern_stripes[LOBBY_STRIPES];
+static pthread_mutex_t public_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PublicEntry *public_head = NULL;
+static PublicEntry *public_tail = NULL;
+
+static unsigned hash_key(const char *key) {
+    unsigned h = 2166136261u; // FNV-1a
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h & (LOBBY_BUCKETS - 1);
+}
+
+static pthread_mutex_t *stripe_of(LobbyIndex *index, unsigned bucket) {
+    return &index->stripes[bucket & (LOBBY_STRIPES - 1)];
+}
+
+static int index_init(LobbyIndex *index) {
+    index->buckets = calloc(LOBBY_BUCKETS, sizeof(LobbyNode *));
+    if (!index->buckets) return -1;
+    for (int i = 0; i < LOBBY_STRIPES; i++) {
+        pthread_mutex_init(&index->stripes[i], NULL);
+    }
+    return 0;
+}
+
+int lobby_init(void) {
+    interned = calloc(LOBBY_BUCKETS, sizeof(InternNode *));
+    if (index_init(&names) < 0 || index_init(&rooms) < 0 || !interned) {
+        fprintf(stderr, "lobby: sem memoria para os indices.\n");
+        return -1;
+    }
+    for (int i = 0; i < LOBBY_STRIPES; i++) {
+        pthread_mutex_init(&intern_stripes[i], NULL);
+    }
+    return 0;
+}
+
+// Remove a chave do balde (com o lock da faixa ja adquirido). Se match nao for NULL,
+// so remove se a entrada apontar para essa partida. Retorna a entrada removida.
+static LobbyNode *bucket_remove(LobbyIndex *index, unsigned bucket, const char *key, struct Match *match) {
+    for (LobbyNode **pp = &index->buckets[bucket]; *pp; pp = &(*pp)->next) {
+        LobbyNode *node = *pp;
+        if (strcmp(node->key, key) == 0 && (match == NULL || node->match == match)) {
+            *pp = node->next;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static LobbyNode *bucket_find(LobbyIndex *index, unsigned bucket, const char *key) {
+    for (LobbyNode *node = index->buckets[bucket]; node; node = node->next) {
+        if (strcmp(node->key, key) == 0) return node;
+    }
+    return NULL;
+}
+
+static LobbyNode *node_create(const char *key, struct Match *match) {
+    LobbyNode *node = malloc(sizeof(LobbyNode));
+    if (!node) return NULL;
+    snprintf(node->key, sizeof(node->key), "%s", key);
+    node->match = match;
+    return node;
+}
+
+// --- Nomes online ---
+
+int lobby_register_name(const char *name) {
+    unsigned bucket = hash_key(name);
+    pthread_mutex_t *lock = stripe_of(&names, bucket);
+    int result = LOBBY_NAME_IN_USE;
+
+    pthread_mutex_lock(lock);
+    if (!bucket_find(&names, bucket, name)) {
+        LobbyNode *node = node_create(name, NULL);
+        result = LOBBY_NO_MEMORY;
+        if (node) {
+            node->next = names.buckets[bucket];
+            names.buckets[bucket] = node;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(lock);
+    return result;
+}
+
+void lobby_release_name(const char *name) {
+    unsigned bucket = hash_key(name);
+    pthread_mutex_t *lock = stripe_of(&names, bucket);
+
+    pthread_mutex_lock(lock);
+    LobbyNode *node = bucket_remove(&names, bucket, name, NULL);
+    pthread_mutex_unlock(lock);
+    free(node);
+}
+
+// --- Salas privadas ---
+
+struct Match *lobby_take_or_open_room(const char *room, struct Match *fresh) {
+    unsigned bucket = hash_key(room);
+    pthread_mutex_t *lock = stripe_of(&rooms, bucket);
+    struct Match *match = fresh;
+
+    pthread_mutex_lock(lock);
+    LobbyNode *node = bucket_remove(&rooms, bucket, room, NULL);
+    if (node) {
+        match = node->match; // Sala completa: deixa de estar aberta
+        free(node);
+    } else {
+        node = node_create(room, fresh);
+        if (node) {
+            node->next = rooms.buckets[bucket];
+            rooms.buckets[bucket] = node;
+        } else {
+            match = NULL;
+        }
+    }
+    pthread_mutex_unlock(lock);
+    return match;
+}
+
+// --- Fila publica ---
+
+struct Match *lobby_take_or_queue_public(struct Match *fresh) {
+    struct Match *match = fresh;
+
+    pthread_mutex_lock(&public_mutex);
+    if (public_head) {
+        PublicEntry *entry = public_head;
+        public_head = entry->next;
+        if (!public_head) public_tail = NULL;
+        match = entry->match;
+        free(entry);
+    } else {
+        PublicEntry *entry = malloc(sizeof(PublicEntry));
+        if (entry) {
+            entry->match = fresh;
+            entry->next = NULL;
+            public_head = public_tail = entry;
+        } else {
+            match = NULL;
+        }
+    }
+    pthread_mutex_unlock(&public_mutex);
+    return match;
+}
+
+int lobby_withdraw(const char *room, struct Match *match) {
+    if (room && room[0]) {
+        unsigned bucket = hash_key(room);
+        pthread_mutex_t *lock = stripe_of(&rooms, bucket);
+        pthread_mutex_lock(lock);
+        LobbyNode *node = bucket_remove(&rooms, bucket, room, match);
+        pthread_mutex_unlock(lock);
+        int removed = node != NULL;
+        free(node);
+        return removed;
+    }
+
+    int found = 0;
+    pthread_mutex_lock(&public_mutex);
+    PublicEntry *prev = NULL;
+    for (PublicEntry *entry = public_head; entry; prev = entry, entry = entry->next) {
+        if (entry->match != match) continue;
+        if (prev) prev->next = entry->next;
+        else public_head = entry->next;
+        if (public_tail == entry) public_tail = prev;
+        free(entry);
+        found = 1;
+        break;
+    }
+    pthread_mutex_unlock(&public_mutex);
+    return found;
+}
+
+int lobby_reopen(const char *room, struct Match *match) {
+    if (room && room[0]) {
+        unsigned bucket = hash_key(room);
+        pthread_mutex_t *lock = stripe_of(&rooms, bucket);
+        int result = -1;
+        pthread_mutex_lock(lock);
+        if (!bucket_find(&rooms, bucket, room)) {
+            LobbyNode *node = node_create(room, match);
+            if (node) {
+                node->next = rooms.buckets[bucket];
+                rooms.buckets[bucket] = node;
+                result = 0;
+            }
+        }
+        pthread_mutex_unlock(lock);
+        return result;
+    }
+
+    PublicEntry *entry = malloc(sizeof(PublicEntry));
+    if (!entry) return -1;
+    entry->match = match;
+    entry->next = NULL;
+    pthread_mutex_lock(&public_mutex);
+    if (public_tail) public_tail->next = entry;
+    else public_head = entry;
+    public_tail = entry;
+    pthread_mutex_unlock(&public_mutex);
+    return 0;
+}
+
+// --- Textos internados ---
+
+const char *lobby_intern(const char *text) {
+    unsigned bucket = hash_key(text);
+    pthread_mutex_t *lock = &intern_stripes[bucket & (LOBBY_STRIPES - 1)];
+    InternNode *node;
+
+    pthread_mutex_lock(lock);
+    for (node = interned[bucket]; node; node = node->next) {
+        if (strcmp(node->text, text) == 0) break;
+    }
+    if (!node) {
+        size_t len = strlen(text);
+        node = malloc(sizeof(InternNode) + len + 1);
+        if (node) {
+            memcpy(node->text, text, len + 1);
+            node->refs = 0;
+            node->next = interned[bucket];
+            interned[bucket] = node;
+        }
+    }
+    if (node) node->refs++;
+    pthread_mutex_unlock(lock);
+    return node ? node->text : NULL;
+}
+
+void lobby_unintern(const char *text) {
+    if (!text) return;
+    InternNode *node = (InternNode *)(text - offsetof(InternNode, text));
+    unsigned bucket = hash_key(text);
+    pthread_mutex_t *lock = &intern_stripes[bucket & (LOBBY_STRIPES - 1)];
+
+    pthread_mutex_lock(lock);
+    if (--node->refs == 0) {
+        for (InternNode **pp = &interned[bucket]; *pp; pp = &(*pp)->next) {
+            if (*pp == node) {
+                *pp = node->next;
+                break;
+            }
+        }
+    } else {
+        node = NULL;
+    }
+    pthread_mutex_unlock(lock);
+    free(node);
+}
@@ -0,0 +1,46 @@
+#ifndef LOBBY_H
+#define LOBBY_H
+
+// Lobby do servidor: indice concorrente de nomes online e de salas abertas, e a fila
+// publica de emparelhamento.
+// Os indices sao tabelas hash com encadeamento e locks por faixa de baldes, entao
+// registrar um nome, detectar colisao ou achar uma sala custa O(1) sem um lock global.
+
+#define NAME_MAX_LEN 50      // Tamanho de Player.name (inclui o '\0')
+#define ROOM_NAME_LEN 32     // Tamanho maximo do codigo da sala (inclui o '\0')
+#define LOBBY_BUCKETS (1 << 18)
+#define LOBBY_STRIPES 256    // Locks por faixa de baldes
+
+struct Match;
+
+int lobby_init(void);
+
+#define LOBBY_NAME_IN_USE -1 // lobby_register_name: nome ja esta online
+#define LOBBY_NO_MEMORY -2   // lobby_register_name: sem memoria para o registro
+
+// Nomes online: retorna 0 se o nome foi registrado, LOBBY_NAME_IN_USE ou LOBBY_NO_MEMORY
+int lobby_register_name(const char *name);
+void lobby_release_name(const char *name);
+
+// Sala privada: se ja existe uma partida aberta com esse codigo, ela e retirada do
+// indice e retornada (o chamador entra como segundo jogador). Caso contrario, fresh
+// e registrada como aberta e retornada.
+struct Match *lobby_take_or_open_room(const char *room, struct Match *fresh);
+
+// Fila publica: mesmo contrato, emparelhando por ordem de chegada
+struct Match *lobby_take_or_queue_public(struct Match *fresh);
+
+// Retira uma partida ainda aberta (sala ou fila). Retorna 1 se ela estava no lobby.
+int lobby_withdraw(const char *room, struct Match *match);
+
+// Recoloca no lobby, sem emparelhar, uma partida aberta herdada de outro processo
+// (troca de processo). Retorna 0, ou -1 se a sala ja estiver aberta.
+int lobby_reopen(const char *room, struct Match *match);
+
+// Textos internados (nomes de jogador e codigos de sala): cada texto distinto fica uma vez
+// na memoria, com contagem de referencias, e as partidas guardam so o ponteiro.
+// lobby_intern retorna NULL sem memoria; lobby_unintern recebe o ponteiro de lobby_intern.
+const char *lobby_intern(const char *text);
+void lobby_unintern(const char *text);
+
+#endif // LOBBY_H
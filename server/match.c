@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "match.h"
+#include "lobby.h"
+
+const ShipType ship_types[NUM_SHIP_TYPES] = {
+    {'S', 1, "SUBMARINO", 1},
+    {'F', 2, "FRAGATA", 2},
+    {'D', 3, "DESTROYER", 1}
+};
+
+// Registros livres. Os blocos vem do mmap (alinhados a pagina) e sao entregues em ordem,
+// entao so as paginas ja usadas ocupam memoria. Nunca voltam ao kernel: partidas que
+// terminam sao reaproveitadas pelas proximas.
+typedef union FreeRecord {
+    union FreeRecord *next;
+    Match match;
+} FreeRecord;
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FreeRecord *pool = NULL;
+static FreeRecord *slab_next = NULL; // Proximo registro nunca usado do bloco atual
+static FreeRecord *slab_end = NULL;
+
+// Com o pool_mutex travado
+static FreeRecord *record_take(void) {
+    FreeRecord *record = pool;
+    if (record) {
+        pool = record->next;
+        return record;
+    }
+    if (slab_next == slab_end) {
+        FreeRecord *slab = mmap(NULL, MATCH_SLAB_RECORDS * sizeof(FreeRecord), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED) {
+            perror("match: mmap");
+            return NULL;
+        }
+        slab_next = slab;
+        slab_end = slab + MATCH_SLAB_RECORDS;
+    }
+    return slab_next++;
+}
+
+// --- Tabuleiro ---
+
+uint64_t ship_cells(ShipDesc ship) {
+    int x = ship.origin / BOARD_SIZE, y = ship.origin % BOARD_SIZE;
+    uint64_t cells = 0;
+    for (int i = 0; i < ship_types[ship.type].length; i++) {
+        cells |= ship.vertical ? cell_bit(x + i, y) : cell_bit(x, y + i);
+    }
+    return cells;
+}
+
+int player_ship_at(const Player *player, int x, int y) {
+    uint64_t bit = cell_bit(x, y);
+    if (!(player->ships & bit)) return -1;
+    for (int i = 0; i < player->num_ships_placed; i++) {
+        if (ship_cells(player->fleet[i]) & bit) return i;
+    }
+    return -1;
+}
+
+int player_count_ships(const Player *player, int type) {
+    int count = 0;
+    for (int i = 0; i < player->num_ships_placed; i++) {
+        if (player->fleet[i].type == type) count++;
+    }
+    return count;
+}
+
+char player_cell(const Player *player, int x, int y) {
+    uint64_t bit = cell_bit(x, y);
+    if (player->hits & bit) return 'X';
+    if (player->misses & bit) return 'O';
+    int ship = player_ship_at(player, x, y);
+    return ship < 0 ? ' ' : ship_types[player->fleet[ship].type].symbol;
+}
+
+void player_reset(Player *player) {
+    player->ships = 0;
+    player->hits = 0;
+    player->misses = 0;
+    memset(player->fleet, 0, sizeof(player->fleet));
+    player->num_ships_placed = 0; // Resetar contagem de navios no array
+    player->ships_sunk = 0; // Resetar navios afundados
+    player->ready = 0; // Garantir que o jogador não esteja pronto por padrão
+}
+
+void match_note_sunk(Player *attacker, const ShipDesc *ship) {
+    Match *match = player_match(attacker);
+    int index = match->players[0].ships_sunk + match->players[1].ships_sunk - 1;
+    if (index < 0 || index >= (int)sizeof(match->cold.sunk_order)) return;
+    match->cold.sunk_order[index] = (uint8_t)((attacker->id << 3) | ship->type);
+}
+
+int player_set_name(Player *player, const char *name) {
+    const char *interned = lobby_intern(name);
+    if (!interned) return -1;
+    lobby_unintern(player->name);
+    player->name = interned;
+    return 0;
+}
+
+// --- Partidas ---
+
+Match *match_create(const char *room) {
+    const char *interned_room = lobby_intern(room);
+    if (!interned_room) return NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    FreeRecord *record = record_take();
+    pthread_mutex_unlock(&pool_mutex);
+    if (!record) {
+        lobby_unintern(interned_room);
+        return NULL;
+    }
+
+    Match *match = &record->match;
+    memset(match, 0, sizeof(Match));
+    match->cold.room = interned_room;
+    match->current_player_turn = -1;
+    // =================== INÍCIO: REGIÃO DE PARALELISMO ===================
+    pthread_mutex_init(&match->mutex, NULL);
+    coro_cond_init(&match->all_players_ready_cond);
+    coro_cond_init(&match->turn_cond);
+    for (int i = 0; i < PLAYERS_PER_MATCH; i++) {
+        player_reset(&match->players[i]);
+        match->players[i].id = (uint8_t)i;
+        match->players[i].socket = 0; // 0 significa socket nao conectado/inicializado
+        // Cada jogador possui seu próprio lock (BoardLock zerado = livre) para o tabuleiro
+    }
+    // =================== FIM: REGIÃO DE PARALELISMO ===================
+    return match;
+}
+
+void match_destroy(Match *match) {
+    for (int i = 0; i < PLAYERS_PER_MATCH; i++) {
+        if (match->cold.retired_sockets[i] > 0) close(match->cold.retired_sockets[i]);
+        lobby_unintern(match->players[i].name);
+    }
+    lobby_unintern(match->cold.room);
+    pthread_mutex_destroy(&match->mutex);
+
+    FreeRecord *record = (FreeRecord *)match;
+    pthread_mutex_lock(&pool_mutex);
+    record->next = pool;
+    pool = record;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void match_reset(Match *match) {
+    for (int i = 0; i < PLAYERS_PER_MATCH; i++) {
+        board_lock(&match->players[i].lock);
+        player_reset(&match->players[i]);
+        board_unlock(&match->players[i].lock);
+    }
+    match->game_started = 0;
+    match->game_over = 0;
+    match->current_player_turn = -1;
+    match->turn_count = 0;
+    match->rematch = 0;
+    match->cold.started_ms = 0;
+}
+
+void match_release(Match *match) {
+    pthread_mutex_lock(&match->mutex);
+    int refs = --match->refs;
+    pthread_mutex_unlock(&match->mutex);
+    if (refs == 0) match_destroy(match);
+}
@@ -0,0 +1,159 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "../common/protocol.h"
+#include "coro.h"
+
+// Registro compacto de uma partida. Cada tabuleiro sao tres mapas de bits (casa
+// i = x * BOARD_SIZE + y), cada navio cabe em 2 bytes e os nomes sao internados no lobby.
+// O estado quente (tabuleiros, vez, locks) ocupa as tres primeiras linhas de cache; os
+// metadados frios (sala, sessoes, rastreamento) ficam na quarta. Uma partida inteira
+// ocupa MATCH_RECORD_SIZE bytes, alocados em blocos de MATCH_SLAB_RECORDS.
+
+#define PLAYERS_PER_MATCH 2
+#define CACHE_LINE 64
+#define MATCH_RECORD_SIZE 256
+#define MATCH_SLAB_RECORDS 8192 // Partidas por mmap (2 MB)
+
+_Static_assert(BOARD_SIZE * BOARD_SIZE <= 64, "o tabuleiro precisa caber em um uint64_t");
+
+struct Session;
+
+// Valores de game_over: so uma partida com vencedor pode ter revanche
+#define MATCH_OVER_ABANDONED 1 // Um jogador saiu (ou a partida foi encerrada)
+#define MATCH_OVER_WON 2       // Alguem afundou todos os navios do adversario
+#define REMATCH_CANCELLED 0x80 // Em rematch: um dos jogadores saiu, nao havera revanche
+
+// Tipos de navio e seus comprimentos
+typedef struct {
+    char symbol;
+    int length;
+    const char* name;
+    int max_count; // Quantidade máxima desse tipo de navio por jogador
+} ShipType;
+
+extern const ShipType ship_types[];
+#define NUM_SHIP_TYPES 3
+
+// Navio posicionado: casa de origem, tipo (indice em ship_types), orientacao e acertos
+typedef struct {
+    uint8_t origin;       // x * BOARD_SIZE + y
+    uint8_t type : 2;
+    uint8_t vertical : 1;
+    uint8_t hits : 3;     // Acertos recebidos (afunda quando chega ao comprimento)
+} ShipDesc;
+
+// Lock de 4 bytes para o tabuleiro de cada jogador (futex: 0 livre, 1 travado, 2 travado
+// com espera). As secoes criticas sao curtas e nunca suspendem a corrotina.
+typedef uint32_t BoardLock;
+
+static inline void board_lock(BoardLock *lock) {
+    uint32_t c = 0;
+    if (__atomic_compare_exchange_n(lock, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+    if (c != 2) c = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        syscall(SYS_futex, lock, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        c = __atomic_exchange_n(lock, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline void board_unlock(BoardLock *lock) {
+    if (__atomic_exchange_n(lock, 0, __ATOMIC_RELEASE) == 2) {
+        syscall(SYS_futex, lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+// Estrutura para representar um jogador (estado quente, dentro do registro da partida)
+typedef struct {
+    uint64_t ships;  // Casas ocupadas por navios
+    uint64_t hits;   // Tiros recebidos que acertaram um navio
+    uint64_t misses; // Tiros recebidos na agua
+    const char *name; // Internado (lobby_intern); NULL antes do JOIN
+    ShipDesc fleet[MAX_SHIPS]; // Navios na ordem em que foram posicionados
+    int socket;
+    BoardLock lock; // Protege ships, hits, misses e fleet
+    uint8_t id; // Posicao na partida (0 ou 1)
+    uint8_t num_ships_placed;
+    uint8_t ships_sunk; // Quantidade de navios afundados do adversário para este jogador
+    uint8_t ready; // 0 = nao pronto, 1 = pronto
+} Player;
+
+// Metadados frios: so tocados ao entrar, sair, trocar de processo, afundar um navio ou com --trace
+typedef struct {
+    struct Session *sessions[PLAYERS_PER_MATCH]; // Conexao de cada jogador (valida enquanto socket != 0)
+    int retired_sockets[PLAYERS_PER_MATCH]; // Sockets ja encerrados, fechados so com a partida
+    const char *room; // Codigo da sala privada, internado ("" = partida publica)
+    uint64_t handoff_ns; // Instante da ultima troca de turno (rastreamento com --trace)
+    uint64_t started_ms; // Inicio do jogo, os dois prontos (ms desde a epoca, para --results)
+    // Navios afundados em ordem, (atacante << 3) | tipo; validos os ships_sunk dos dois jogadores
+    uint8_t sunk_order[PLAYERS_PER_MATCH * MAX_SHIPS];
+} MatchCold;
+
+// Estado de uma partida. O servidor mantem varias partidas ao mesmo tempo, cada uma
+// criada por uma sala privada ou por um par da fila publica.
+typedef struct Match {
+    Player players[PLAYERS_PER_MATCH]; // Primeiro campo: player_match depende disso
+    // =================== INÍCIO: REGIÃO DE PARALELISMO ===================
+    // Mutex da partida para proteger os jogadores e as flags abaixo
+    pthread_mutex_t mutex;
+    // Condição para sincronizar quando ambos os jogadores estão prontos
+    CoroCond all_players_ready_cond;
+    // Condição para sincronizar a vez de cada jogador
+    CoroCond turn_cond;
+    // =================== FIM: REGIÃO DE PARALELISMO ===================
+    int8_t current_player_turn; // -1 = nenhum, 0 = player 0, 1 = player 1
+    uint8_t game_started; // Flag para indicar se o jogo começou
+    uint8_t game_over; // 0 em andamento, MATCH_OVER_ABANDONED ou MATCH_OVER_WON
+    uint8_t num_players; // Jogadores que ja entraram na partida
+    uint8_t refs; // Referencias: jogadores na partida + entrada aberta no lobby
+    uint8_t rematch; // Pedidos de revanche depois do fim (bit 1 << id) e REMATCH_CANCELLED
+    uint16_t turn_count; // Turnos jogados na partida (para as estatisticas de I/O)
+    MatchCold cold __attribute__((aligned(CACHE_LINE)));
+} __attribute__((aligned(CACHE_LINE))) Match;
+
+_Static_assert(sizeof(Match) == MATCH_RECORD_SIZE, "registro da partida mudou de tamanho");
+_Static_assert(offsetof(Match, cold) == MATCH_RECORD_SIZE - CACHE_LINE, "estado quente passou de tres linhas");
+_Static_assert(sizeof(MatchCold) <= CACHE_LINE, "metadados frios passaram de uma linha");
+
+// Partida do jogador: os jogadores sao o primeiro campo do registro
+static inline Match *player_match(Player *player) {
+    return (Match *)(player - player->id);
+}
+
+static inline uint64_t cell_bit(int x, int y) {
+    return 1ull << (x * BOARD_SIZE + y);
+}
+
+// Casas ocupadas por um navio
+uint64_t ship_cells(ShipDesc ship);
+// Navio do jogador que ocupa a casa, ou -1
+int player_ship_at(const Player *player, int x, int y);
+// Navios ja posicionados de um tipo
+int player_count_ships(const Player *player, int type);
+// Casa no formato de caracteres (' ', 'S', 'F', 'D', 'X' acerto, 'O' agua)
+char player_cell(const Player *player, int x, int y);
+// Apaga tabuleiro, navios, afundados e pronto
+void player_reset(Player *player);
+// Registra na ordem de afundamentos da partida um navio afundado pelo atacante (chamar
+// depois de incrementar attacker->ships_sunk)
+void match_note_sunk(Player *attacker, const ShipDesc *ship);
+// Troca o nome (internado) do jogador. Retorna 0 ou -1 sem memoria.
+int player_set_name(Player *player, const char *name);
+
+// Cria uma partida vazia (ainda sem jogadores). NULL sem memoria.
+Match *match_create(const char *room);
+void match_destroy(Match *match);
+// Volta a partida terminada ao posicionamento, com os mesmos jogadores (revanche).
+// Chamada com o mutex da partida travado.
+void match_reset(Match *match);
+// Solta uma referencia da partida e a libera quando ninguem mais a usa
+void match_release(Match *match);
+
+#endif // MATCH_H
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ratings.h"
+#include "coro.h"
+
+#define RATINGS_MAGIC 0x474E5452 // "RTNG"
+#define RATINGS_VERSION 1
+#define BITMAP_WORDS (RATING_BUCKETS / 64)
+
+// Cabecalho do arquivo. Os registros vem logo depois, em um vetor de capacity slots.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t clean;          // Sem uso: o indice e reconstruido a cada abertura
+    uint32_t journal_valid;  // 1 se o journal contem uma atualizacao que precisa ser (re)aplicada
+    uint32_t journal_count;
+    int32_t journal_slot[2];
+    RatingRecord journal_rec[2];
+    int32_t bucket_head[RATING_BUCKETS];
+    uint64_t bucket_bitmap[BITMAP_WORDS];
+} RatingsHeader;
+
+// Resultado esperando a thread de gravacao
+typedef struct {
+    char winner[RATING_NAME_LEN];
+    char loser[RATING_NAME_LEN];
+    int winner_sunk;
+    int loser_sunk;
+} PendingResult;
+
+// ratings_mutex protege a tabela e o indice (lidos por TOP/RATING). So a thread de gravacao
+// escreve neles; o journal e os msync ficam fora do mutex, entao consultas nao esperam o disco.
+static pthread_mutex_t ratings_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Fila circular de resultados, protegida por queue_mutex. Cheia, quem enfileira espera:
+// corrotinas em space_coro_cond (so a sessao para), threads comuns em space_cond.
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static CoroCond space_coro_cond = CORO_COND_INITIALIZER;
+static pthread_cond_t space_cond = PTHREAD_COND_INITIALIZER;
+static PendingResult queue[RATINGS_QUEUE_LEN];
+static unsigned queue_head = 0, queue_len = 0;
+static int writer_stopping = 0;
+static pthread_t writer_thread;
+static RatingsHeader *hdr = NULL;
+static RatingRecord *slots = NULL;
+static size_t map_size = 0;
+static int map_fd = -1;
+
+// msync exige endereco alinhado a pagina
+static void sync_range(void *addr, size_t len) {
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+    msync((void *)start, (uintptr_t)addr + len - start, MS_SYNC);
+}
+
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Procura o slot do nome. Se nao existir, retorna o slot livre onde ele entraria
+// (ou -1 se a tabela estiver cheia). *found indica se o nome ja existia.
+// reserved e um slot livre ja prometido a outro nome na mesma atualizacao (-1 = nenhum).
+static int32_t find_slot(const char *name, int32_t reserved, int *found) {
+    uint32_t mask = hdr->capacity - 1;
+    uint32_t idx = hash_name(name) & mask;
+    for (uint32_t probe = 0; probe < hdr->capacity; probe++) {
+        RatingRecord *rec = &slots[idx];
+        if (!rec->used && (int32_t)idx != reserved) {
+            *found = 0;
+            return (int32_t)idx;
+        }
+        if (rec->used && strncmp(rec->name, name, RATING_NAME_LEN) == 0) {
+            *found = 1;
+            return (int32_t)idx;
+        }
+        idx = (idx + 1) & mask;
+    }
+    *found = 0;
+    return -1;
+}
+
+static int clamp_elo(int elo) {
+    if (elo < 0) return 0;
+    if (elo >= RATING_BUCKETS) return RATING_BUCKETS - 1;
+    return elo;
+}
+
+// --- Indice ordenado (baldes por valor de Elo) ---
+
+static void index_unlink(int32_t slot) {
+    RatingRecord *rec = &slots[slot];
+    int bucket = rec->elo;
+    if (rec->prev >= 0) slots[rec->prev].next = rec->next;
+    else hdr->bucket_head[bucket] = rec->next;
+    if (rec->next >= 0) slots[rec->next].prev = rec->prev;
+    if (hdr->bucket_head[bucket] < 0) hdr->bucket_bitmap[bucket / 64] &= ~(1ULL << (bucket % 64));
+    rec->prev = rec->next = -1;
+}
+
+static void index_link(int32_t slot) {
+    RatingRecord *rec = &slots[slot];
+    int bucket = rec->elo;
+    rec->prev = -1;
+    rec->next = hdr->bucket_head[bucket];
+    if (rec->next >= 0) slots[rec->next].prev = slot;
+    hdr->bucket_head[bucket] = slot;
+    hdr->bucket_bitmap[bucket / 64] |= 1ULL << (bucket % 64);
+}
+
+// Reconstroi o indice a partir da tabela. Feito a cada abertura: uma atualizacao sincroniza so
+// os dois registros do resultado, e os encadeamentos que ela mudou nos vizinhos do balde podem
+// nao ter chegado ao disco antes de uma queda.
+static void index_rebuild(void) {
+    for (int i = 0; i < RATING_BUCKETS; i++) hdr->bucket_head[i] = -1;
+    memset(hdr->bucket_bitmap, 0, sizeof(hdr->bucket_bitmap));
+    hdr->count = 0;
+    for (uint32_t i = 0; i < hdr->capacity; i++) {
+        if (!slots[i].used) continue;
+        slots[i].elo = clamp_elo(slots[i].elo);
+        index_link((int32_t)i);
+        hdr->count++;
+    }
+}
+
+// Aplica as entradas do journal na tabela e no indice. Idempotente: os registros do
+// journal guardam os valores finais, entao reaplicar apos uma queda da o mesmo resultado.
+static void journal_apply(int index_consistent) {
+    for (uint32_t i = 0; i < hdr->journal_count; i++) {
+        int32_t slot = hdr->journal_slot[i];
+        RatingRecord *rec = &slots[slot];
+        if (index_consistent && rec->used) index_unlink(slot);
+        else if (!rec->used) hdr->count++;
+        int32_t prev = rec->prev, next = rec->next;
+        *rec = hdr->journal_rec[i];
+        rec->prev = prev;
+        rec->next = next;
+        if (index_consistent) index_link(slot);
+    }
+}
+
+static void *writer_main(void *arg);
+
+int ratings_open(const char *path, uint32_t capacity) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        fprintf(stderr, "Capacidade do arquivo de ratings deve ser potencia de 2.\n");
+        return -1;
+    }
+
+    map_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (map_fd < 0) {
+        perror("ratings: open");
+        return -1;
+    }
+
+    struct stat st;
+    fstat(map_fd, &st);
+    int fresh = st.st_size == 0;
+    if (!fresh) {
+        // Arquivo existente: a capacidade vem do proprio cabecalho
+        RatingsHeader probe;
+        if (pread(map_fd, &probe, sizeof(probe), 0) != sizeof(probe) || probe.magic != RATINGS_MAGIC ||
+            probe.version != RATINGS_VERSION) {
+            fprintf(stderr, "Arquivo de ratings %s invalido ou de outra versao.\n", path);
+            close(map_fd);
+            map_fd = -1;
+            return -1;
+        }
+        capacity = probe.capacity;
+    }
+
+    map_size = sizeof(RatingsHeader) + (size_t)capacity * sizeof(RatingRecord);
+    if (!fresh && (uint64_t)st.st_size < map_size) {
+        // Arquivo cortado: acessar o mapeamento alem do fim daria SIGBUS
+        fprintf(stderr, "Arquivo de ratings %s invalido ou de outra versao.\n", path);
+        close(map_fd);
+        map_fd = -1;
+        return -1;
+    }
+    if (fresh && ftruncate(map_fd, (off_t)map_size) < 0) {
+        perror("ratings: ftruncate");
+        close(map_fd);
+        map_fd = -1;
+        return -1;
+    }
+
+    void *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+    if (base == MAP_FAILED) {
+        perror("ratings: mmap");
+        close(map_fd);
+        map_fd = -1;
+        return -1;
+    }
+    hdr = base;
+    slots = (RatingRecord *)((char *)base + sizeof(RatingsHeader));
+
+    if (fresh) {
+        hdr->magic = RATINGS_MAGIC;
+        hdr->version = RATINGS_VERSION;
+        hdr->capacity = capacity;
+        msync(base, map_size, MS_SYNC);
+    } else if (hdr->journal_valid) {
+        // Recuperacao: reaplica o resultado interrompido e so entao descarta o journal
+        printf("DEBUG: ratings: reaplicando atualizacao interrompida.\n");
+        journal_apply(0);
+        msync(base, map_size, MS_SYNC);
+        hdr->journal_valid = 0;
+        sync_range(hdr, sizeof(RatingsHeader));
+    }
+    index_rebuild(); // Os encadeamentos gravados no arquivo nunca sao usados
+    printf("DEBUG: ratings: %u jogadores carregados de %s (capacidade %u).\n", hdr->count, path, hdr->capacity);
+
+    writer_stopping = 0;
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        perror("ratings: pthread_create");
+        munmap(base, map_size);
+        hdr = NULL;
+        slots = NULL;
+        close(map_fd);
+        map_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void ratings_close(void) {
+    if (!hdr) return;
+    pthread_mutex_lock(&queue_mutex);
+    writer_stopping = 1;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    pthread_join(writer_thread, NULL); // A thread aplica o que ainda esta na fila antes de sair
+
+    pthread_mutex_lock(&ratings_mutex);
+    if (hdr) {
+        msync(hdr, map_size, MS_SYNC);
+        munmap(hdr, map_size);
+        hdr = NULL;
+        slots = NULL;
+    }
+    if (map_fd >= 0) close(map_fd);
+    map_fd = -1;
+    pthread_mutex_unlock(&ratings_mutex);
+}
+
+int ratings_enabled(void) {
+    return hdr != NULL;
+}
+
+// Prepara o registro atualizado de um jogador na entrada i do journal
+static int journal_stage(int i, const char *name, int32_t reserved, int32_t *slot_out) {
+    int found;
+    int32_t slot = find_slot(name, reserved, &found);
+    if (slot < 0) return -1;
+    RatingRecord *rec = &hdr->journal_rec[i];
+    if (found) {
+        *rec = slots[slot];
+    } else {
+        memset(rec, 0, sizeof(*rec));
+        strncpy(rec->name, name, RATING_NAME_LEN - 1);
+        rec->used = 1;
+        rec->elo = RATING_INITIAL;
+    }
+    rec->prev = rec->next = -1;
+    hdr->journal_slot[i] = slot;
+    *slot_out = slot;
+    return 0;
+}
+
+// Aplica um resultado com o protocolo do journal (so a thread de gravacao). O journal fica no
+// cabecalho e nao e lido pelas consultas: so a aplicacao na tabela e no indice trava ratings_mutex.
+static void apply_result(const PendingResult *r) {
+    int32_t ws, ls;
+    if (journal_stage(0, r->winner, -1, &ws) < 0 || journal_stage(1, r->loser, ws, &ls) < 0) {
+        fprintf(stderr, "ratings: tabela cheia, resultado nao registrado.\n");
+        return;
+    }
+
+    RatingRecord *w = &hdr->journal_rec[0];
+    RatingRecord *l = &hdr->journal_rec[1];
+    double expected = 1.0 / (1.0 + pow(10.0, (l->elo - w->elo) / 400.0));
+    int delta = (int)lround(RATING_K * (1.0 - expected));
+    w->elo = clamp_elo(w->elo + delta);
+    l->elo = clamp_elo(l->elo - delta);
+    w->wins++;
+    l->losses++;
+    w->ships_sunk += (uint32_t)r->winner_sunk;
+    l->ships_sunk += (uint32_t)r->loser_sunk;
+
+    // 1) Persiste o journal e marca a atualizacao como em andamento
+    hdr->journal_count = 2;
+    sync_range(hdr, sizeof(RatingsHeader));
+    hdr->journal_valid = 1;
+    sync_range(&hdr->journal_valid, sizeof(hdr->journal_valid));
+
+    // 2) Aplica na tabela e no indice
+    pthread_mutex_lock(&ratings_mutex);
+    journal_apply(1);
+    pthread_mutex_unlock(&ratings_mutex);
+    sync_range(&slots[ws], sizeof(RatingRecord));
+    sync_range(&slots[ls], sizeof(RatingRecord));
+
+    // 3) Conclui: journal descartado. O indice nao precisa estar no disco (ratings_open o
+    // reconstroi), entao os vizinhos do balde nao sao sincronizados.
+    hdr->journal_valid = 0;
+    sync_range(&hdr->journal_valid, sizeof(hdr->journal_valid));
+
+    printf("DEBUG: ratings: %s %d (+%d), %s %d (-%d).\n", r->winner, slots[ws].elo, delta, r->loser, slots[ls].elo, delta);
+}
+
+// Thread de gravacao: aplica os resultados na ordem em que chegaram
+static void *writer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_mutex);
+    while (1) {
+        while (queue_len == 0 && !writer_stopping) pthread_cond_wait(&queue_cond, &queue_mutex);
+        if (queue_len == 0) break; // Parando e com a fila vazia
+        PendingResult r = queue[queue_head];
+        queue_head = (queue_head + 1) % RATINGS_QUEUE_LEN;
+        queue_len--;
+        coro_cond_broadcast(&space_coro_cond);
+        pthread_cond_broadcast(&space_cond);
+        pthread_mutex_unlock(&queue_mutex);
+
+        apply_result(&r);
+
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+int ratings_record_result(const char *winner, const char *loser, int winner_sunk, int loser_sunk) {
+    if (!hdr || strcmp(winner, loser) == 0) return -1;
+    pthread_mutex_lock(&queue_mutex);
+    // A thread de gravacao esvazia a fila mesmo parando, entao a espera sempre termina
+    while (queue_len == RATINGS_QUEUE_LEN) {
+        if (coro_self()) coro_cond_wait(&space_coro_cond, &queue_mutex, 0);
+        else pthread_cond_wait(&space_cond, &queue_mutex);
+    }
+    PendingResult *r = &queue[(queue_head + queue_len) % RATINGS_QUEUE_LEN];
+    snprintf(r->winner, sizeof(r->winner), "%s", winner);
+    snprintf(r->loser, sizeof(r->loser), "%s", loser);
+    r->winner_sunk = winner_sunk;
+    r->loser_sunk = loser_sunk;
+    queue_len++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return 0;
+}
+
+int ratings_lookup(const char *name, RatingRecord *out) {
+    if (!hdr) return -1;
+    pthread_mutex_lock(&ratings_mutex);
+    int found;
+    int32_t slot = find_slot(name, -1, &found);
+    if (found) *out = slots[slot];
+    pthread_mutex_unlock(&ratings_mutex);
+    return found ? 0 : -1;
+}
+
+int ratings_top(RatingRecord *out, int n) {
+    if (!hdr || n <= 0) return 0;
+    pthread_mutex_lock(&ratings_mutex);
+    int copied = 0;
+    // Percorre os baldes nao vazios do maior Elo para o menor usando o bitmap
+    for (int w = BITMAP_WORDS - 1; w >= 0 && copied < n; w--) {
+        uint64_t bits = hdr->bucket_bitmap[w];
+        while (bits && copied < n) {
+            int b = 63 - __builtin_clzll(bits);
+            bits &= ~(1ULL << b);
+            for (int32_t s = hdr->bucket_head[w * 64 + b]; s >= 0 && copied < n; s = slots[s].next) {
+                out[copied++] = slots[s];
+            }
+        }
+    }
+    pthread_mutex_unlock(&ratings_mutex);
+    return copied;
+}
@@ -0,0 +1,50 @@
+#ifndef RATINGS_H
+#define RATINGS_H
+
+#include <stdint.h>
+
+// Ranking persistente dos jogadores, guardado em um arquivo mapeado em memoria.
+// - Tabela hash (enderecamento aberto) indexada pelo nome: consulta O(1)
+// - Indice ordenado por rating (um balde por valor de Elo + bitmap de baldes nao vazios):
+//   atualizacao O(1) e TOP N sem varrer a tabela. Reconstruido da tabela a cada abertura.
+// - Atualizacoes protegidas por um journal no cabecalho: apos uma queda, o resultado
+//   da partida e aplicado por inteiro ou nao e aplicado
+// - Resultados entram em uma fila e uma thread de fundo os aplica e sincroniza com o disco,
+//   fora do caminho do turno
+
+#define RATING_NAME_LEN 50      // Mesmo tamanho de Player.name
+#define RATING_INITIAL 1200     // Elo inicial de um jogador novo
+#define RATING_K 32             // Fator K da formula de Elo
+#define RATING_BUCKETS 4096     // Elo limitado a [0, RATING_BUCKETS - 1]
+#define RATINGS_DEFAULT_CAPACITY 65536 // Slots da tabela (potencia de 2)
+#define RATINGS_QUEUE_LEN 4096  // Resultados esperando a thread de gravacao
+
+typedef struct {
+    char name[RATING_NAME_LEN];
+    uint16_t used;        // 1 se o slot esta ocupado
+    int32_t elo;
+    uint32_t wins;
+    uint32_t losses;
+    uint32_t ships_sunk;  // Navios do adversario afundados no total
+    int32_t prev;         // Vizinhos no balde do indice ordenado (-1 = nenhum)
+    int32_t next;
+} RatingRecord;
+
+// Abre (ou cria) o arquivo de ratings e inicia a thread de gravacao. Retorna 0 em caso de sucesso.
+int ratings_open(const char *path, uint32_t capacity);
+// Aplica os resultados ainda na fila, para a thread e fecha o arquivo
+void ratings_close(void);
+int ratings_enabled(void);
+
+// Enfileira o resultado de uma partida (chamado no momento do WIN/LOSE; nao faz I/O). Com a
+// fila cheia espera a thread de gravacao (dentro de uma corrotina, so a sessao espera).
+// Retorna -1 se o ranking esta desativado.
+int ratings_record_result(const char *winner, const char *loser, int winner_sunk, int loser_sunk);
+
+// Copia o registro do jogador em *out. Retorna 0 se encontrado.
+int ratings_lookup(const char *name, RatingRecord *out);
+
+// Preenche out com os n melhores jogadores. Retorna quantos foram copiados.
+int ratings_top(RatingRecord *out, int n);
+
+#endif // RATINGS_H
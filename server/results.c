@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "results.h"
+
+// Grupo em memoria, linha a linha; a thread de gravacao transpoe para colunas
+typedef struct {
+    uint32_t rows;
+    ResultsRow data[RESULTS_GROUP_ROWS];
+} ResultsGroup;
+
+static int results_fd = -1;
+static pthread_t flush_thread;
+static pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t results_cond = PTHREAD_COND_INITIALIZER;
+// Dois grupos circulam: um recebe linhas (active) e o outro esta livre (spare), cheio
+// esperando a thread (full) ou sendo gravado (nenhum dos dois ponteiros)
+static ResultsGroup *active = NULL;
+static ResultsGroup *full = NULL;
+static ResultsGroup *spare = NULL;
+static int stopping = 0;
+static unsigned long dropped = 0; // Linhas descartadas com a gravacao atrasada
+static unsigned char *out_buf = NULL; // Grupo transposto (so a thread usa)
+
+static size_t column_field_offset(int column) {
+#define RESULTS_COLUMN_FIELD(id, field) case RESULTS_COL_##id: return offsetof(ResultsRow, field);
+    switch (column) {
+        RESULTS_COLUMNS(RESULTS_COLUMN_FIELD)
+    }
+#undef RESULTS_COLUMN_FIELD
+    return 0;
+}
+
+// Com o results_mutex travado, full == NULL e spare != NULL
+static void swap_active(void) {
+    full = active;
+    active = spare;
+    spare = NULL;
+    pthread_cond_signal(&results_cond);
+}
+
+static int write_all(const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(results_fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Transpoe o grupo em colunas e grava tudo em uma escrita (sem o mutex)
+static void write_group(const ResultsGroup *group) {
+    size_t bytes = results_group_bytes(group->rows);
+    memset(out_buf, 0, bytes);
+    ResultsGroupHeader header = { RESULTS_GROUP_MAGIC, group->rows, bytes };
+    memcpy(out_buf, &header, sizeof(header));
+    for (int c = 0; c < RESULTS_NUM_COLUMNS; c++) {
+        size_t width = results_column_width(c);
+        size_t field = column_field_offset(c);
+        unsigned char *out = out_buf + results_column_offset(c, group->rows);
+        for (uint32_t r = 0; r < group->rows; r++) {
+            memcpy(out + r * width, (const unsigned char *)&group->data[r] + field, width);
+        }
+    }
+    if (write_all(out_buf, bytes) < 0) perror("results: write");
+}
+
+// Thread de gravacao: grava cada grupo cheio e, a cada RESULTS_FLUSH_MS, o grupo incompleto
+static void *flush_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&results_mutex);
+    while (1) {
+        if (!full) {
+            if (stopping) {
+                if (active->rows == 0) break;
+                swap_active();
+            } else {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += RESULTS_FLUSH_MS / 1000;
+                deadline.tv_nsec += (RESULTS_FLUSH_MS % 1000) * 1000000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                int r = pthread_cond_timedwait(&results_cond, &results_mutex, &deadline);
+                if (!full && r == ETIMEDOUT && active->rows > 0) swap_active();
+                if (!full) continue;
+            }
+        }
+
+        ResultsGroup *group = full;
+        full = NULL;
+        unsigned long lost = dropped;
+        dropped = 0;
+        pthread_mutex_unlock(&results_mutex);
+
+        write_group(group);
+        if (lost) printf("DEBUG: Resultados: %lu partidas descartadas (gravacao atrasada).\n", lost);
+
+        pthread_mutex_lock(&results_mutex);
+        group->rows = 0;
+        spare = group;
+        if (active->rows == RESULTS_GROUP_ROWS) swap_active(); // Encheu durante a gravacao
+    }
+    pthread_mutex_unlock(&results_mutex);
+    return NULL;
+}
+
+// Confere o cabecalho e descarta um grupo cortado no fim (queda no meio de uma escrita).
+// Retorna 0 se o arquivo pode receber grupos.
+static int check_file(int fd, const char *path) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -1;
+
+    ResultsFileHeader header;
+    if (st.st_size == 0) {
+        header.magic = RESULTS_MAGIC;
+        header.version = RESULTS_VERSION;
+        header.row_bytes = (uint32_t)results_row_bytes();
+        header.group_rows = RESULTS_GROUP_ROWS;
+        return pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) ? 0 : -1;
+    }
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || header.magic != RESULTS_MAGIC ||
+        header.version != RESULTS_VERSION || header.row_bytes != results_row_bytes()) {
+        fprintf(stderr, "results: %s nao e um arquivo de resultados desta versao.\n", path);
+        return -1;
+    }
+
+    off_t end = sizeof(header);
+    ResultsGroupHeader group;
+    while (end < st.st_size) {
+        if (pread(fd, &group, sizeof(group), end) != (ssize_t)sizeof(group) || group.magic != RESULTS_GROUP_MAGIC ||
+            group.bytes != results_group_bytes(group.rows) || end + (off_t)group.bytes > st.st_size) {
+            break;
+        }
+        end += (off_t)group.bytes;
+    }
+    if (end < st.st_size) {
+        printf("DEBUG: Resultados: %lld bytes incompletos no fim de %s descartados.\n",
+               (long long)(st.st_size - end), path);
+        if (ftruncate(fd, end) < 0) return -1;
+    }
+    return 0;
+}
+
+int results_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("results: open");
+        return -1;
+    }
+    if (check_file(fd, path) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    ResultsGroup *a = calloc(1, sizeof(ResultsGroup));
+    ResultsGroup *b = calloc(1, sizeof(ResultsGroup));
+    unsigned char *buf = malloc(results_group_bytes(RESULTS_GROUP_ROWS));
+    if (!a || !b || !buf) {
+        free(a);
+        free(b);
+        free(buf);
+        close(fd);
+        return -1;
+    }
+
+    pthread_mutex_lock(&results_mutex);
+    results_fd = fd;
+    active = a;
+    spare = b;
+    full = NULL;
+    out_buf = buf;
+    stopping = 0;
+    dropped = 0;
+    pthread_mutex_unlock(&results_mutex);
+
+    if (pthread_create(&flush_thread, NULL, flush_main, NULL) != 0) {
+        pthread_mutex_lock(&results_mutex);
+        active = NULL;
+        pthread_mutex_unlock(&results_mutex);
+        free(a);
+        free(b);
+        free(buf);
+        close(fd);
+        results_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void results_close(void) {
+    if (results_fd < 0) return;
+    pthread_mutex_lock(&results_mutex);
+    stopping = 1;
+    pthread_cond_signal(&results_cond);
+    pthread_mutex_unlock(&results_mutex);
+    pthread_join(flush_thread, NULL); // A thread grava o que falta antes de sair
+
+    pthread_mutex_lock(&results_mutex);
+    free(active);
+    free(spare);
+    active = spare = full = NULL;
+    pthread_mutex_unlock(&results_mutex);
+    free(out_buf);
+    out_buf = NULL;
+    close(results_fd);
+    results_fd = -1;
+}
+
+int results_enabled(void) {
+    return results_fd >= 0;
+}
+
+void results_record(const ResultsRow *row) {
+    pthread_mutex_lock(&results_mutex);
+    if (active && active->rows < RESULTS_GROUP_ROWS) {
+        active->data[active->rows++] = *row;
+        if (active->rows == RESULTS_GROUP_ROWS && !full && spare) swap_active();
+    } else if (active) {
+        dropped++;
+    }
+    pthread_mutex_unlock(&results_mutex);
+}
@@ -0,0 +1,107 @@
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Exportacao dos resultados das partidas (--results <arquivo>) em formato colunar, para
+// analises sem interpretar o log DEBUG. Cada partida com vencedor vira uma linha. As linhas
+// se acumulam em grupos na memoria e uma thread de fundo grava cada grupo de uma vez no fim
+// do arquivo, coluna por coluna, todas de largura fixa. Um leitor le so as colunas de que
+// precisa (bench/results_scan).
+//
+// Arquivo: ResultsFileHeader seguido de grupos. Cada grupo: ResultsGroupHeader e, para cada
+// coluna na ordem de RESULTS_COLUMNS, rows valores contiguos; o grupo e completado com zeros
+// ate um multiplo de 8 bytes. Processos diferentes (troca de processo) podem acrescentar
+// grupos ao mesmo arquivo: cada grupo e gravado em uma unica escrita com O_APPEND.
+
+#define RESULTS_MAGIC 0x31535242u       // "BRS1": cabecalho do arquivo
+#define RESULTS_GROUP_MAGIC 0x31475242u // "BRG1": cabecalho de cada grupo
+#define RESULTS_VERSION 1               // Mudou alguma coluna: incrementar
+#define RESULTS_GROUP_ROWS 4096         // Linhas de um grupo cheio
+#define RESULTS_FLUSH_MS 1000           // Grupo incompleto vai para o disco depois desse tempo
+#define RESULTS_NAME_LEN 50             // Mesmo tamanho de NAME_MAX_LEN
+#define RESULTS_SUNK_MAX 8              // Navios dos dois jogadores (2 * MAX_SHIPS)
+#define RESULTS_SUNK_NONE 0xFF          // Posicao sem navio afundado em sunk_order
+
+#define RESULTS_FLAG_SALVO 0x01 // Partida jogada no modo salvo
+
+// Uma partida. Na memoria as linhas ficam nesse formato; no arquivo, transpostas em colunas.
+typedef struct {
+    uint64_t end_ms;      // Fim da partida (ms desde a epoca)
+    uint32_t duration_ms; // Do inicio do jogo (os dois prontos) ao tiro final
+    uint16_t turns;       // Trocas de vez
+    uint8_t winner;       // Posicao do vencedor (0 ou 1)
+    uint8_t flags;        // RESULTS_FLAG_*
+    uint16_t shots[2];    // Casas em que cada jogador atirou
+    uint16_t hits[2];     // Tiros de cada jogador que acertaram um navio
+    uint8_t sunk_order[RESULTS_SUNK_MAX]; // Na ordem: (atacante << 3) | tipo do navio (indice em ship_types)
+    char names[2][RESULTS_NAME_LEN];
+} ResultsRow;
+
+// Colunas, na ordem em que aparecem em cada grupo: X(identificador, campo de ResultsRow)
+#define RESULTS_COLUMNS(X) \
+    X(END_MS, end_ms)      \
+    X(DURATION, duration_ms) \
+    X(TURNS, turns)        \
+    X(WINNER, winner)      \
+    X(FLAGS, flags)        \
+    X(SHOTS, shots)        \
+    X(HITS, hits)          \
+    X(SUNK_ORDER, sunk_order) \
+    X(NAMES, names)
+
+#define RESULTS_COLUMN_ID(id, field) RESULTS_COL_##id,
+enum { RESULTS_COLUMNS(RESULTS_COLUMN_ID) RESULTS_NUM_COLUMNS };
+#undef RESULTS_COLUMN_ID
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t row_bytes;  // Soma das larguras das colunas (confere o layout)
+    uint32_t group_rows; // RESULTS_GROUP_ROWS de quem criou o arquivo (so informativo)
+} ResultsFileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t rows;
+    uint64_t bytes; // Tamanho do grupo, cabecalho e alinhamento incluidos
+} ResultsGroupHeader;
+
+// Largura de uma coluna em bytes
+static inline size_t results_column_width(int column) {
+#define RESULTS_COLUMN_WIDTH(id, field) case RESULTS_COL_##id: return sizeof(((ResultsRow *)0)->field);
+    switch (column) {
+        RESULTS_COLUMNS(RESULTS_COLUMN_WIDTH)
+    }
+#undef RESULTS_COLUMN_WIDTH
+    return 0;
+}
+
+// Deslocamento da coluna dentro de um grupo de rows linhas (a partir do cabecalho do grupo)
+static inline size_t results_column_offset(int column, uint32_t rows) {
+    size_t offset = sizeof(ResultsGroupHeader);
+    for (int c = 0; c < column; c++) offset += results_column_width(c) * rows;
+    return offset;
+}
+
+static inline size_t results_row_bytes(void) {
+    return results_column_offset(RESULTS_NUM_COLUMNS, 1) - sizeof(ResultsGroupHeader);
+}
+
+// Tamanho de um grupo de rows linhas no arquivo
+static inline size_t results_group_bytes(uint32_t rows) {
+    return (results_column_offset(RESULTS_NUM_COLUMNS, rows) + 7) & ~(size_t)7;
+}
+
+// Abre (ou cria) o arquivo e inicia a thread de gravacao. Retorna 0 em caso de sucesso.
+int results_open(const char *path);
+// Grava o que estiver acumulado, para a thread e fecha o arquivo
+void results_close(void);
+int results_enabled(void);
+
+// Acrescenta uma partida ao grupo atual (copia a linha; nao faz I/O). Se a gravacao estiver
+// atrasada e os dois grupos estiverem cheios, a linha e descartada e contada.
+void results_record(const ResultsRow *row);
+
+#endif // RESULTS_H
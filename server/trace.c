@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "coro.h"
+
+typedef struct {
+    const char *name; // Sempre uma string estatica
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int turn;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+    pthread_mutex_t mutex; // Sessao dona x thread de descarga
+    int tid;
+    int count;
+    struct TraceBuffer *prev; // Lista de buffers vivos (buffers_mutex)
+    struct TraceBuffer *next;
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+int trace_enabled = 0;
+
+static FILE *trace_file = NULL;
+static pthread_mutex_t trace_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int trace_pid;
+
+// Ordem dos locks: buffers_mutex, depois o do buffer, depois trace_file_mutex
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond = PTHREAD_COND_INITIALIZER;
+static TraceBuffer *buffers = NULL;
+static int flusher_stopping = 0;
+static pthread_t flusher_thread;
+
+static void *flusher_main(void *arg);
+
+uint64_t trace_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int trace_open(const char *path) {
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        perror("trace: fopen");
+        return -1;
+    }
+    // Formato de vetor JSON: o ']' final e opcional, entao o arquivo continua valido
+    // mesmo se o servidor for interrompido
+    fprintf(trace_file, "[\n");
+    fflush(trace_file);
+    trace_pid = getpid();
+    flusher_stopping = 0;
+    if (pthread_create(&flusher_thread, NULL, flusher_main, NULL) != 0) {
+        perror("trace: pthread_create");
+        fclose(trace_file);
+        trace_file = NULL;
+        return -1;
+    }
+    trace_enabled = 1;
+    return 0;
+}
+
+void trace_close(void) {
+    if (!trace_file) return;
+    trace_thread_exit();
+    pthread_mutex_lock(&buffers_mutex);
+    flusher_stopping = 1;
+    pthread_cond_signal(&flusher_cond);
+    pthread_mutex_unlock(&buffers_mutex);
+    pthread_join(flusher_thread, NULL); // Descarrega os buffers das sessoes vivas antes de sair
+    pthread_mutex_lock(&trace_file_mutex);
+    fprintf(trace_file, "{}]\n");
+    fclose(trace_file);
+    trace_file = NULL;
+    trace_enabled = 0;
+    pthread_mutex_unlock(&trace_file_mutex);
+}
+
+// Buffer da sessao atual (cada corrotina aparece como uma "thread" no visualizador)
+static TraceBuffer *get_buffer(void) {
+    TraceBuffer *buf = coro_local(CORO_LOCAL_TRACE);
+    if (!buf) {
+        buf = malloc(sizeof(TraceBuffer));
+        if (!buf) return NULL;
+        pthread_mutex_init(&buf->mutex, NULL);
+        int id = coro_id();
+        buf->tid = id ? id : (int)syscall(SYS_gettid);
+        buf->count = 0;
+        buf->prev = NULL;
+        pthread_mutex_lock(&buffers_mutex);
+        buf->next = buffers;
+        if (buffers) buffers->prev = buf;
+        buffers = buf;
+        pthread_mutex_unlock(&buffers_mutex);
+        coro_set_local(CORO_LOCAL_TRACE, buf);
+    }
+    return buf;
+}
+
+// Escreve os intervalos acumulados como eventos completos ("ph":"X"), em microssegundos.
+// Com o lock do buffer travado.
+static void buffer_flush(TraceBuffer *buf) {
+    if (buf->count == 0) return;
+    pthread_mutex_lock(&trace_file_mutex);
+    if (trace_file) {
+        for (int i = 0; i < buf->count; i++) {
+            TraceEvent *ev = &buf->events[i];
+            fprintf(trace_file,
+                    "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"turno\":%d}},\n",
+                    ev->name, trace_pid, buf->tid, ev->start_ns / 1000.0, (ev->end_ns - ev->start_ns) / 1000.0, ev->turn);
+        }
+        fflush(trace_file);
+    }
+    pthread_mutex_unlock(&trace_file_mutex);
+    buf->count = 0;
+}
+
+void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, int turn) {
+    TraceBuffer *buf = get_buffer();
+    if (!buf) return;
+    pthread_mutex_lock(&buf->mutex);
+    if (buf->count == TRACE_BUFFER_EVENTS) buffer_flush(buf);
+    TraceEvent *ev = &buf->events[buf->count++];
+    ev->name = name;
+    ev->start_ns = start_ns;
+    ev->end_ns = end_ns < start_ns ? start_ns : end_ns;
+    ev->turn = turn;
+    pthread_mutex_unlock(&buf->mutex);
+}
+
+static void flush_all(void) {
+    for (TraceBuffer *buf = buffers; buf; buf = buf->next) {
+        pthread_mutex_lock(&buf->mutex);
+        buffer_flush(buf);
+        pthread_mutex_unlock(&buf->mutex);
+    }
+}
+
+// Thread de descarga: a cada TRACE_FLUSH_MS grava o que as sessoes acumularam, e uma ultima
+// vez ao parar (trace_close)
+static void *flusher_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&buffers_mutex);
+    while (!flusher_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += TRACE_FLUSH_MS / 1000;
+        deadline.tv_nsec += (TRACE_FLUSH_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&flusher_cond, &buffers_mutex, &deadline) == ETIMEDOUT) flush_all();
+    }
+    flush_all();
+    pthread_mutex_unlock(&buffers_mutex);
+    return NULL;
+}
+
+void trace_thread_name(const char *name) {
+    if (!trace_enabled) return;
+    TraceBuffer *buf = get_buffer();
+    if (!buf) return;
+
+    // Escapa o nome para JSON (nomes de jogador vem do cliente)
+    char escaped[128];
+    size_t j = 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p && j < sizeof(escaped) - 7; p++) {
+        if (*p == '"' || *p == '\\') {
+            escaped[j++] = '\\';
+            escaped[j++] = (char)*p;
+        } else if (*p < 0x20) {
+            j += (size_t)snprintf(escaped + j, sizeof(escaped) - j, "\\u%04x", *p);
+        } else {
+            escaped[j++] = (char)*p;
+        }
+    }
+    escaped[j] = '\0';
+
+    pthread_mutex_lock(&trace_file_mutex);
+    if (trace_file) {
+        fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                trace_pid, buf->tid, escaped);
+    }
+    pthread_mutex_unlock(&trace_file_mutex);
+}
+
+void trace_thread_exit(void) {
+    TraceBuffer *buf = coro_local(CORO_LOCAL_TRACE);
+    if (!buf) return;
+    pthread_mutex_lock(&buffers_mutex);
+    if (buf->prev) buf->prev->next = buf->next;
+    else buffers = buf->next;
+    if (buf->next) buf->next->prev = buf->prev;
+    pthread_mutex_unlock(&buffers_mutex);
+    buffer_flush(buf); // Fora da lista: so esta sessao ve o buffer
+    pthread_mutex_destroy(&buf->mutex);
+    free(buf);
+    coro_set_local(CORO_LOCAL_TRACE, NULL);
+}
@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Rastreamento opcional de latencia por etapa (ativado com --trace <arquivo>).
+// Cada sessao (corrotina) grava seus intervalos em um buffer proprio, com um lock que so a
+// thread de descarga disputa; o buffer e descarregado no arquivo (formato Chrome trace /
+// Perfetto) quando enche, quando a sessao termina e a cada TRACE_FLUSH_MS, para que uma
+// sessao parada ou um encerramento por sinal nao retenham os intervalos. Com o rastreamento
+// desligado, cada ponto de medicao custa um teste.
+
+#define TRACE_BUFFER_EVENTS 1024 // Intervalos por buffer de sessao antes de descarregar
+#define TRACE_FLUSH_MS 1000      // Periodo da thread que descarrega os buffers de todas as sessoes
+
+extern int trace_enabled;
+
+int trace_open(const char *path);
+void trace_close(void); // Descarrega todos os buffers e fecha o arquivo
+
+// Tempo monotonico em nanossegundos (0 se o rastreamento estiver desligado)
+uint64_t trace_clock(void);
+static inline uint64_t trace_now(void) {
+    return trace_enabled ? trace_clock() : 0;
+}
+
+// Registra um intervalo [start_ns, end_ns] da sessao atual. turn identifica o turno
+// da partida, para correlacionar os intervalos dos dois jogadores.
+void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, int turn);
+static inline void trace_span(const char *name, uint64_t start_ns, int turn) {
+    if (trace_enabled) trace_record(name, start_ns, trace_clock(), turn);
+}
+
+// Nome exibido para a sessao atual no visualizador (ex.: nome do jogador)
+void trace_thread_name(const char *name);
+
+// Descarrega e libera o buffer da sessao atual (chamar antes de ela terminar)
+void trace_thread_exit(void);
+
+#endif // TRACE_H